@@ -0,0 +1,202 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "charset.h"
+#include "utils.h"
+
+/* Latin-1 0xc0-0xff without accents, for ROMs that lack them */
+static const char latin1_base[64] =
+	"AAAAAAACEEEEIIII" "DNOOOOOxOUUUUYPs"
+	"aaaaaaaceeeeiiii" "dnooooo/ouuuuypy";
+
+/* Latin-1 chars found somewhere else in the A00 ROM */
+static const uint8_t a00_remap[][2] = {
+	{ 0xa2, 0xec }, /* cent */
+	{ 0xa5, 0x5c }, /* yen */
+	{ 0xb0, 0xdf }, /* degree */
+	{ 0xb5, 0xe4 }, /* micro */
+	{ 0xb7, 0xa5 }, /* middle dot */
+	{ 0xc4, 0xe1 }, /* no capitals with umlaut, use the small ones */
+	{ 0xd6, 0xef },
+	{ 0xdc, 0xf5 },
+	{ 0xdf, 0xe2 }, /* sharp s */
+	{ 0xe4, 0xe1 },
+	{ 0xf1, 0xee },
+	{ 0xf6, 0xef },
+	{ 0xf7, 0xfd }, /* division */
+	{ 0xfc, 0xf5 },
+};
+
+/* A00 has the yen sign and arrows there */
+static const uint8_t glyph_backslash[8] = {
+	0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00,
+};
+static const uint8_t glyph_tilde[8] = {
+	0x00, 0x00, 0x00, 0x0d, 0x12, 0x00, 0x00, 0x00,
+};
+
+static void charset_glyph(struct charset *cs, uint8_t c, uint8_t slot,
+			  const uint8_t *bmp)
+{
+	slot &= CHARSET_NGLYPHS - 1;
+	memcpy(cs->glyphs[slot], bmp, 8);
+	cs->glyph_mask |= 1 << slot;
+	cs->map[c] = slot;
+}
+
+void charset_init(struct charset *cs, enum charset_rom rom)
+{
+	unsigned int i;
+
+	memset(cs, 0, sizeof(*cs));
+	for (i = 0; i < 256; i++)
+		cs->map[i] = i;
+
+	switch (rom) {
+	case CHARSET_LEGACY:
+		cs->map[0xff] = '#';
+		break;
+	case CHARSET_A00:
+		/* Latin-1 control chars and no break space */
+		for (i = 0x80; i <= 0xa0; i++)
+			cs->map[i] = ' ';
+		for (i = 0xa1; i < 0xc0; i++)
+			cs->map[i] = CHARSET_FALLBACK;
+		for (i = 0xc0; i <= 0xff; i++)
+			cs->map[i] = latin1_base[i - 0xc0];
+		for (i = 0; i < sizeof(a00_remap) / sizeof(a00_remap[0]); i++)
+			cs->map[a00_remap[i][0]] = a00_remap[i][1];
+		/* Full block, as used by clients for bars */
+		cs->map[0xff] = 0xff;
+		charset_glyph(cs, '\\', 7, glyph_backslash);
+		charset_glyph(cs, '~', 6, glyph_tilde);
+		break;
+	case CHARSET_A02:
+		/* Close enough to latin-1 but for the control chars */
+		for (i = 0x80; i <= 0xa0; i++)
+			cs->map[i] = ' ';
+		break;
+	}
+}
+
+int charset_load(struct charset *cs, const char *path)
+{
+	unsigned int c, code, slot, bmp[8];
+	uint8_t glyph[8];
+	char line[96], *p;
+	int lineno = 0, ret = 0, i;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		error("charset: can't open %s: %d\n", path, -errno);
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		p = strchr(line, '#');
+		if (p)
+			*p = '\0';
+		if (sscanf(line, "%x g%u %x %x %x %x %x %x %x %x", &c, &slot,
+			   &bmp[0], &bmp[1], &bmp[2], &bmp[3], &bmp[4], &bmp[5],
+			   &bmp[6], &bmp[7]) == 10 && c < 256 &&
+		    slot < CHARSET_NGLYPHS) {
+			for (i = 0; i < 8; i++)
+				glyph[i] = bmp[i] & 0x1f;
+			charset_glyph(cs, c, slot, glyph);
+		} else if (sscanf(line, "%x %x", &c, &code) == 2 && c < 256 &&
+			   code < 256) {
+			cs->map[c] = code;
+		} else if (strspn(line, " \t\r\n") != strlen(line)) {
+			error("charset: %s:%d: bad line\n", path, lineno);
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+	fclose(f);
+	return ret;
+}
+
+int charset_parse(struct charset *cs, const char *name)
+{
+	if (!strcasecmp(name, "legacy")) {
+		charset_init(cs, CHARSET_LEGACY);
+		return 0;
+	}
+	if (!strcasecmp(name, "a00")) {
+		charset_init(cs, CHARSET_A00);
+		return 0;
+	}
+	if (!strcasecmp(name, "a02")) {
+		charset_init(cs, CHARSET_A02);
+		return 0;
+	}
+	charset_init(cs, CHARSET_DEFAULT);
+	return charset_load(cs, name);
+}
+
+void charset_release(struct charset *cs, uint8_t slot)
+{
+	int i;
+
+	slot &= CHARSET_NGLYPHS - 1;
+	if (!(cs->glyph_mask & (1 << slot)))
+		return;
+	cs->glyph_mask &= ~(1 << slot);
+	/* Clients' own custom chars (0x00 to 0x07) are left alone */
+	for (i = CHARSET_NGLYPHS; i < 256; i++) {
+		if (cs->map[i] == slot)
+			cs->map[i] = CHARSET_FALLBACK;
+	}
+}
+
+void charset_map(const struct charset *cs, uint8_t *dst, const uint8_t *src,
+		 int len)
+{
+	const uint8_t *map = cs->map;
+	int i = 0;
+
+	/* No branch per char: a 256 entries gather can't be vectorized on
+	 * the targets we run on, but unrolled loads and stores keep the
+	 * pipeline busy. */
+	for (; i + 8 <= len; i += 8) {
+		uint8_t c0 = map[src[i]], c1 = map[src[i + 1]];
+		uint8_t c2 = map[src[i + 2]], c3 = map[src[i + 3]];
+		uint8_t c4 = map[src[i + 4]], c5 = map[src[i + 5]];
+		uint8_t c6 = map[src[i + 6]], c7 = map[src[i + 7]];
+
+		dst[i] = c0;
+		dst[i + 1] = c1;
+		dst[i + 2] = c2;
+		dst[i + 3] = c3;
+		dst[i + 4] = c4;
+		dst[i + 5] = c5;
+		dst[i + 6] = c6;
+		dst[i + 7] = c7;
+	}
+	for (; i < len; i++)
+		dst[i] = map[src[i]];
+}
@@ -0,0 +1,80 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <stdint.h>
+
+#define CHARSET_NGLYPHS 8
+/* Shown for the chars the ROM does not have */
+#define CHARSET_FALLBACK '?'
+
+enum charset_rom {
+	/* What the translator always did: only 0xff becomes '#' */
+	CHARSET_LEGACY,
+	/* HD44780 ROM code A00, japanese */
+	CHARSET_A00,
+	/* HD44780 ROM code A02, european */
+	CHARSET_A02,
+};
+
+#if defined(CONFIG_LCD_TRANSLATOR_CHARSET_A00)
+#  define CHARSET_DEFAULT CHARSET_A00
+#elif defined(CONFIG_LCD_TRANSLATOR_CHARSET_A02)
+#  define CHARSET_DEFAULT CHARSET_A02
+#else
+#  define CHARSET_DEFAULT CHARSET_LEGACY
+#endif
+
+/* Client chars (latin-1) to display ROM codes.
+ * Chars missing from the ROM can be mapped to a custom char slot: its
+ * bitmap must be loaded on the display before using the table.
+ */
+struct charset {
+	uint8_t map[256];
+	/* Custom char slots used by map, one bit each */
+	uint8_t glyph_mask;
+	uint8_t glyphs[CHARSET_NGLYPHS][8];
+};
+
+void charset_init(struct charset *cs, enum charset_rom rom);
+
+/* Override entries of cs from a file, one per line:
+ *   <char> <code>              map char to a ROM code
+ *   <char> g<slot> <8 rows>    map char to a custom char
+ * Values are hex, '#' starts a comment.
+ * Return 0 or a negative errno.
+ */
+int charset_load(struct charset *cs, const char *path);
+
+/* name is "legacy", "a00", "a02" or the path of a file applied over
+ * CHARSET_DEFAULT.
+ */
+int charset_parse(struct charset *cs, const char *name);
+
+/* The slot was given to someone else: chars using it fall back to
+ * CHARSET_FALLBACK. */
+void charset_release(struct charset *cs, uint8_t slot);
+
+/* Translate a run of chars, dst and src can be the same buffer */
+void charset_map(const struct charset *cs, uint8_t *dst, const uint8_t *src,
+		 int len);
+
+#endif /* CHARSET_H */
@@ -0,0 +1,230 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmdq.h"
+#include "screen.h"
+
+#if (CMDQ_LEN & (CMDQ_LEN - 1))
+#  error "CMDQ_LEN must be a power of 2"
+#endif
+#if (CMDQ_SHED >= CMDQ_LEN)
+#  error "CMDQ_SHED must be lower than CMDQ_LEN"
+#endif
+
+/* Commands queued while shedding before looking for more to shed */
+#define CMDQ_SHED_STEP (CMDQ_SHED / 4 + 1)
+
+struct cmdq {
+	/* The display as the queued commands leave it, for the cursor */
+	struct screen shadow;
+	unsigned int head;
+	unsigned int tail;
+	/* Backlog above CMDQ_SHED, pushes since the last shedding */
+	int shedding;
+	int since_shed;
+	int lagging;
+	struct cmdq_stats st;
+	struct proto_cmd_data q[CMDQ_LEN];
+};
+
+struct cmdq *cmdq_init(uint8_t nrows, uint8_t ncolumns)
+{
+	struct cmdq *q = calloc(1, sizeof(*q));
+
+	if (!q)
+		return NULL;
+	screen_init(&q->shadow, nrows, ncolumns);
+	return q;
+}
+
+void cmdq_deinit(struct cmdq *q)
+{
+	free(q);
+}
+
+int cmdq_depth(struct cmdq *q)
+{
+	return q->head - q->tail;
+}
+
+/* cmd as queued: text and relative moves at the position they apply to */
+static void cmdq_norm(struct cmdq *q, const struct proto_cmd_data *cmd,
+		      struct proto_cmd_data *d)
+{
+	struct screen *s = &q->shadow;
+
+	*d = *cmd;
+	switch (cmd->cmd) {
+	case PROTO_CMD_ASCII:
+		d->cmd = PROTO_CMD_TEXT;
+		d->data.text.row = 0;
+		d->data.text.col = 0;
+		d->data.text.len = 1;
+		d->data.text.buf[0] = cmd->data.ascii;
+		/* fallthrough */
+	case PROTO_CMD_TEXT:
+		if (!d->data.text.row && !d->data.text.col) {
+			d->data.text.row = s->row + 1;
+			d->data.text.col = s->col + 1;
+		}
+		break;
+	default:
+		break;
+	}
+
+	screen_apply(s, cmd);
+
+	if (cmd->cmd == PROTO_CMD_CURSOR_LEFT || cmd->cmd == PROTO_CMD_CURSOR_RIGHT) {
+		d->cmd = PROTO_CMD_SET_CURSOR_POS;
+		d->data.pos.row = s->row + 1;
+		d->data.pos.col = s->col + 1;
+	}
+}
+
+static int cmdq_pos_valid(struct cmdq *q, uint8_t row, uint8_t col)
+{
+	return row >= 1 && row <= q->shadow.nrows &&
+	       col >= 1 && col <= q->shadow.ncolumns;
+}
+
+/* Walk the queue from the newest command, tracking the cells and the
+ * cursor that later commands set, and drop what they supersede. */
+static void cmdq_shed(struct cmdq *q)
+{
+	uint8_t written[(LCD_MAX_CELLS + 7) / 8];
+	int ncells = q->shadow.nrows * q->shadow.ncolumns;
+	int cursor_set = 0, covered, i, cell;
+	unsigned int n, w;
+	struct proto_cmd_data *d;
+
+	memset(written, 0, sizeof(written));
+	for (n = q->head; n != q->tail; ) {
+		d = &q->q[--n & (CMDQ_LEN - 1)];
+		switch (d->cmd) {
+		case PROTO_CMD_TEXT:
+			if (!cmdq_pos_valid(q, d->data.text.row, d->data.text.col))
+				break;
+			cell = (d->data.text.row - 1) * q->shadow.ncolumns +
+			       d->data.text.col - 1;
+			covered = 1;
+			for (i = 0; i < d->data.text.len; i++) {
+				int c = (cell + i) % ncells;
+
+				covered &= !!(written[c / 8] & (1 << (c % 8)));
+				written[c / 8] |= 1 << (c % 8);
+			}
+			if (covered) {
+				d->cmd = PROTO_CMD_INVALID;
+				q->st.shed_text++;
+			}
+			cursor_set = 1;
+			break;
+		case PROTO_CMD_SET_CURSOR_POS:
+			if (!cmdq_pos_valid(q, d->data.pos.row, d->data.pos.col))
+				break;
+			/* fallthrough */
+		case PROTO_CMD_SEND_CURSOR_HOME:
+			if (cursor_set) {
+				d->cmd = PROTO_CMD_INVALID;
+				q->st.shed_cursor++;
+			}
+			cursor_set = 1;
+			break;
+		case PROTO_CMD_CLR_DISPLAY:
+			memset(written, 0xff, sizeof(written));
+			cursor_set = 1;
+			break;
+		default:
+			/* Never dropped */
+			break;
+		}
+	}
+
+	/* Close the gaps, oldest first */
+	for (n = w = q->tail; n != q->head; n++) {
+		d = &q->q[n & (CMDQ_LEN - 1)];
+		if (d->cmd == PROTO_CMD_INVALID)
+			continue;
+		if (w != n)
+			q->q[w & (CMDQ_LEN - 1)] = *d;
+		w++;
+	}
+	q->head = w;
+	q->since_shed = 0;
+}
+
+int cmdq_push(struct cmdq *q, const struct proto_cmd_data *cmd)
+{
+	int depth;
+
+	if (cmdq_depth(q) == CMDQ_LEN) {
+		if (q->since_shed)
+			cmdq_shed(q);
+		if (cmdq_depth(q) == CMDQ_LEN) {
+			q->st.full++;
+			return -EAGAIN;
+		}
+	}
+
+	cmdq_norm(q, cmd, &q->q[q->head & (CMDQ_LEN - 1)]);
+	q->head++;
+	q->since_shed++;
+	q->st.pushed++;
+
+	depth = cmdq_depth(q);
+	if (depth > q->st.max_depth)
+		q->st.max_depth = depth;
+	if (depth < CMDQ_SHED)
+		return 0;
+	if (!q->shedding) {
+		q->shedding = 1;
+		q->st.sheds++;
+		cmdq_shed(q);
+	} else if (q->since_shed >= CMDQ_SHED_STEP) {
+		cmdq_shed(q);
+	}
+	return 0;
+}
+
+int cmdq_pop(struct cmdq *q, struct proto_cmd_data *cmd)
+{
+	if (q->head == q->tail)
+		return 0;
+	*cmd = q->q[q->tail & (CMDQ_LEN - 1)];
+	q->tail++;
+	if (cmdq_depth(q) < CMDQ_SHED)
+		q->shedding = 0;
+	return 1;
+}
+
+void cmdq_lag(struct cmdq *q, int lagging)
+{
+	if (lagging && !q->lagging)
+		q->st.overloads++;
+	q->lagging = lagging;
+}
+
+void cmdq_stats(struct cmdq *q, struct cmdq_stats *st)
+{
+	*st = q->st;
+}
@@ -0,0 +1,83 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CMDQ_H
+#define CMDQ_H
+
+#include <stdint.h>
+#include "proto.h"
+
+#ifdef CONFIG_LCD_TRANSLATOR_CMDQ_LEN
+#  define CMDQ_LEN CONFIG_LCD_TRANSLATOR_CMDQ_LEN
+#else
+#  define CMDQ_LEN 64 /* Must be power of 2 */
+#endif
+
+#ifdef CONFIG_LCD_TRANSLATOR_CMDQ_SHED
+#  define CMDQ_SHED CONFIG_LCD_TRANSLATOR_CMDQ_SHED
+#else
+#  define CMDQ_SHED 16
+#endif
+
+/* Input already waiting is parsed before the display is updated, for at
+ * most this long */
+#define CMDQ_BATCH_MS 20
+
+struct cmdq_stats {
+	uint32_t pushed;
+	/* Text runs and cursor moves dropped, a later command superseded them */
+	uint32_t shed_text;
+	uint32_t shed_cursor;
+	/* Times the backlog crossed CMDQ_SHED, shedding started */
+	uint32_t sheds;
+	/* Times the input got ahead of the display, see cmdq_lag() */
+	uint32_t overloads;
+	/* Pushes refused, the queue was full of commands that cannot be shed */
+	uint32_t full;
+	uint16_t max_depth;
+};
+
+struct cmdq;
+
+/* Commands between the parser and the display, for a display of nrows x
+ * ncolumns. Text and cursor moves are queued at the absolute position
+ * they apply to, which lets the queue tell when a later command
+ * supersedes them.
+ */
+struct cmdq *cmdq_init(uint8_t nrows, uint8_t ncolumns);
+void cmdq_deinit(struct cmdq *q);
+
+/* Queue cmd. Past CMDQ_SHED queued commands, text whose cells are all
+ * written again (or cleared) later and cursor moves followed by another
+ * one are dropped: applying what is left gives the same screen.
+ * Anything else (clear, custom chars, bars, modes...) is kept.
+ * Return 0 or -EAGAIN when full, cmd must then wait for cmdq_pop().
+ */
+int cmdq_push(struct cmdq *q, const struct proto_cmd_data *cmd);
+/* Oldest command. Return 1, 0 when empty */
+int cmdq_pop(struct cmdq *q, struct proto_cmd_data *cmd);
+int cmdq_depth(struct cmdq *q);
+/* Tell if the batch just parsed ended with input still waiting, past
+ * CMDQ_BATCH_MS: the display is not keeping up. Each run of lagging
+ * batches counts as one overload. */
+void cmdq_lag(struct cmdq *q, int lagging);
+
+void cmdq_stats(struct cmdq *q, struct cmdq_stats *st);
+
+#endif /* CMDQ_H */
@@ -0,0 +1,352 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compositor.h"
+#include "utils.h"
+
+/* Unchanged cells between two changed spans that are rewritten anyway,
+ * cheaper than moving the cursor again. */
+#define COMP_SPAN_GAP 3
+/* Style of the cursor, taken from the client that owns it */
+#define COMP_CURSOR_FLAGS (SCREEN_F_UNDERLINE | SCREEN_F_BLINK)
+
+struct comp_client {
+	struct mtxorb_hndl *proto;
+	struct proto_cmd_ops ops;
+	/* What the client would see on its own display */
+	struct screen scr;
+	struct comp_region region;
+	uint8_t priority;
+	/* Number of changes made by the client */
+	uint32_t frame;
+};
+
+struct compositor {
+	enum comp_mode mode;
+	uint8_t nrows;
+	uint8_t ncolumns;
+	struct comp_client client[COMP_MAX_CLIENTS];
+	int nclients;
+	/* Last client that sent something, its cursor is the one shown */
+	int focus;
+	/* Priority mode: client on the display and since when */
+	int owner;
+	uint32_t switched_ms;
+	/* What is on the display */
+	struct screen shown;
+	comp_emit_t emit;
+	void *ctx;
+};
+
+struct compositor *compositor_init(enum comp_mode mode, uint8_t nrows,
+				   uint8_t ncolumns, comp_emit_t emit, void *ctx)
+{
+	struct compositor *comp;
+
+	comp = calloc(1, sizeof(*comp));
+	if (!comp)
+		return NULL;
+	comp->mode = mode;
+	comp->nrows = nrows;
+	comp->ncolumns = ncolumns;
+	comp->emit = emit;
+	comp->ctx = ctx;
+	comp->switched_ms = time_ms();
+	/* The display is cleared at init */
+	screen_init(&comp->shown, nrows, ncolumns);
+	return comp;
+}
+
+void compositor_deinit(struct compositor *comp)
+{
+	int i;
+
+	if (!comp)
+		return;
+	for (i = 0; i < comp->nclients; i++)
+		proto_mtxorb_deinit(comp->client[i].proto);
+	free(comp);
+}
+
+int compositor_add_client(struct compositor *comp,
+			  const struct comp_region *region, uint8_t priority)
+{
+	struct comp_client *cl;
+	struct comp_region full = { 0, 0, comp->nrows, comp->ncolumns };
+
+	if (comp->nclients >= COMP_MAX_CLIENTS)
+		return -ENOSPC;
+
+	if (comp->mode == COMP_MODE_PRIORITY || !region)
+		region = &full;
+	if (!region->nrows || !region->ncolumns ||
+	    region->row + region->nrows > comp->nrows ||
+	    region->col + region->ncolumns > comp->ncolumns)
+		return -EINVAL;
+
+	cl = &comp->client[comp->nclients];
+	memset(cl, 0, sizeof(*cl));
+	if (proto_mtxorb_init(&cl->proto, &cl->ops) < 0)
+		return -ENOMEM;
+	cl->region = *region;
+	cl->priority = priority;
+	screen_init(&cl->scr, region->nrows, region->ncolumns);
+
+	return comp->nclients++;
+}
+
+static int comp_visible(struct compositor *comp, int id)
+{
+	return comp->mode == COMP_MODE_REGION || comp->owner == id;
+}
+
+/* Send a command to the display, keeping track of what it shows */
+static void comp_emit(struct compositor *comp, const struct proto_cmd_data *d)
+{
+	screen_apply(&comp->shown, d);
+	comp->emit(comp->ctx, d);
+}
+
+static void comp_client_cmd(struct compositor *comp, int id,
+			    const struct proto_cmd_data *d)
+{
+	struct comp_client *cl = &comp->client[id];
+
+	switch (d->cmd) {
+	case PROTO_CMD_SET_CONTRAST:
+	case PROTO_CMD_BACKLIGHT_ON:
+	case PROTO_CMD_BACKLIGHT_OFF:
+	case PROTO_CMD_BACKLIGHT_LVL:
+	case PROTO_CMD_GPO_OFF:
+	case PROTO_CMD_GPO_ON:
+		/* Not part of the screen: only the client on display drives
+		 * them. */
+		if (comp_visible(comp, id))
+			comp->emit(comp->ctx, d);
+		break;
+	default:
+		if (screen_apply(&cl->scr, d))
+			cl->frame++;
+		break;
+	}
+}
+
+void compositor_input(struct compositor *comp, int id, const uint8_t *buf,
+		      int len)
+{
+	struct comp_client *cl = &comp->client[id];
+	struct proto_cmd_data d;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (cl->ops.parse_cmd(cl->proto, buf[i], &d) == 1)
+			comp_client_cmd(comp, id, &d);
+	}
+	comp->focus = id;
+}
+
+/* Priority mode: pick the client to show, rotating between the ones with
+ * the same priority. Clients that never drew anything are skipped.
+ * Return the ms before the next rotation or -1.
+ */
+static int comp_pick_owner(struct compositor *comp)
+{
+	uint32_t now = time_ms();
+	int best = -1, candidates = 0;
+	int i, id;
+
+	for (i = 0; i < comp->nclients; i++) {
+		struct comp_client *cl = &comp->client[i];
+
+		if (!cl->frame)
+			continue;
+		if (cl->priority > best) {
+			best = cl->priority;
+			candidates = 0;
+		}
+		if (cl->priority == best)
+			candidates++;
+	}
+	if (best < 0)
+		return -1;
+
+	if (comp->client[comp->owner].frame &&
+	    comp->client[comp->owner].priority == best &&
+	    (candidates == 1 || now - comp->switched_ms < COMP_ROTATE_MS))
+		goto exit_rotate;
+
+	for (i = 1; i <= comp->nclients; i++) {
+		id = (comp->owner + i) % comp->nclients;
+		if (comp->client[id].frame && comp->client[id].priority == best)
+			break;
+	}
+	comp->owner = id;
+	comp->switched_ms = now;
+
+exit_rotate:
+	if (candidates < 2)
+		return -1;
+	return COMP_ROTATE_MS - (now - comp->switched_ms);
+}
+
+/* The cursor is the one of the client shown, or in focus, style included */
+static uint8_t comp_cursor_flags(const struct screen *target,
+				 const struct comp_client *cl)
+{
+	return (target->flags & ~COMP_CURSOR_FLAGS) |
+	       (cl->scr.flags & COMP_CURSOR_FLAGS);
+}
+
+static void comp_compose(struct compositor *comp, struct screen *target)
+{
+	const struct comp_client *cl;
+	int i, r;
+
+	screen_init(target, comp->nrows, comp->ncolumns);
+
+	if (comp->mode == COMP_MODE_PRIORITY) {
+		cl = &comp->client[comp->owner];
+		memcpy(target->cells, cl->scr.cells, sizeof(target->cells));
+		memcpy(target->glyphs, cl->scr.glyphs, sizeof(target->glyphs));
+		target->glyph_mask = cl->scr.glyph_mask;
+		target->row = cl->scr.row;
+		target->col = cl->scr.col;
+		target->flags = comp_cursor_flags(target, cl);
+		return;
+	}
+
+	/* Overlapping regions: the last client wins, custom chars too */
+	for (i = 0; i < comp->nclients; i++) {
+		cl = &comp->client[i];
+		for (r = 0; r < cl->region.nrows; r++)
+			memcpy(&target->cells[cl->region.row + r][cl->region.col],
+			       cl->scr.cells[r], cl->region.ncolumns);
+		for (r = 0; r < SCREEN_NGLYPHS; r++) {
+			if (cl->scr.glyph_mask & (1 << r))
+				memcpy(target->glyphs[r], cl->scr.glyphs[r], 8);
+		}
+		target->glyph_mask |= cl->scr.glyph_mask;
+	}
+	cl = &comp->client[comp->focus];
+	target->row = cl->region.row + cl->scr.row;
+	target->col = cl->region.col + cl->scr.col;
+	target->flags = comp_cursor_flags(target, cl);
+}
+
+static void comp_emit_pos(struct compositor *comp, int r, int c)
+{
+	struct proto_cmd_data d;
+
+	memset(&d, 0, sizeof(d));
+	d.cmd = PROTO_CMD_SET_CURSOR_POS;
+	d.data.pos.row = r + 1;
+	d.data.pos.col = c + 1;
+	comp_emit(comp, &d);
+}
+
+static void comp_emit_flag(struct compositor *comp, const struct screen *target,
+			   uint8_t flag, enum proto_cmds on, enum proto_cmds off)
+{
+	struct proto_cmd_data d;
+
+	if ((comp->shown.flags & flag) == (target->flags & flag))
+		return;
+	memset(&d, 0, sizeof(d));
+	d.cmd = target->flags & flag ? on : off;
+	comp_emit(comp, &d);
+}
+
+static void comp_emit_span(struct compositor *comp, const struct screen *target,
+			   int r, int start, int end)
+{
+	struct proto_cmd_data d;
+	int n;
+
+	memset(&d, 0, sizeof(d));
+	d.cmd = PROTO_CMD_TEXT;
+	for (; start <= end; start += n) {
+		n = end - start + 1;
+		if (n > PROTO_TEXT_MAX)
+			n = PROTO_TEXT_MAX;
+		d.data.text.row = r + 1;
+		d.data.text.col = start + 1;
+		d.data.text.len = n;
+		memcpy(d.data.text.buf, &target->cells[r][start], n);
+		comp_emit(comp, &d);
+	}
+}
+
+int compositor_flush(struct compositor *comp)
+{
+	struct screen target;
+	struct proto_cmd_data d;
+	int next = -1;
+	int i, r, c;
+
+	if (!comp->nclients)
+		return -1;
+
+	if (comp->mode == COMP_MODE_PRIORITY)
+		next = comp_pick_owner(comp);
+	comp_compose(comp, &target);
+
+	/* Custom chars first, so that cells using them are right at once */
+	memset(&d, 0, sizeof(d));
+	d.cmd = PROTO_CMD_ADD_CUSTOM_CHAR;
+	for (i = 0; i < SCREEN_NGLYPHS; i++) {
+		if (!(target.glyph_mask & (1 << i)))
+			continue;
+		if ((comp->shown.glyph_mask & (1 << i)) &&
+		    !memcmp(comp->shown.glyphs[i], target.glyphs[i], 8))
+			continue;
+		d.data.custom_char.idx = i;
+		memcpy(d.data.custom_char.bmp, target.glyphs[i], 8);
+		comp_emit(comp, &d);
+	}
+
+	for (r = 0; r < comp->nrows; r++) {
+		int start = -1, last = -1;
+
+		for (c = 0; c < comp->ncolumns; c++) {
+			if (comp->shown.cells[r][c] == target.cells[r][c])
+				continue;
+			if (start >= 0 && c - last > COMP_SPAN_GAP + 1) {
+				comp_emit_span(comp, &target, r, start, last);
+				start = -1;
+			}
+			if (start < 0)
+				start = c;
+			last = c;
+		}
+		if (start >= 0)
+			comp_emit_span(comp, &target, r, start, last);
+	}
+
+	if (comp->shown.row != target.row || comp->shown.col != target.col)
+		comp_emit_pos(comp, target.row, target.col);
+	comp_emit_flag(comp, &target, SCREEN_F_UNDERLINE,
+		       PROTO_CMD_UNDERLINE_CURSOR_ON, PROTO_CMD_UNDERLINE_CURSOR_OFF);
+	comp_emit_flag(comp, &target, SCREEN_F_BLINK,
+		       PROTO_CMD_BLINK_CURSOR_ON, PROTO_CMD_BLINK_CURSOR_OFF);
+
+	return next;
+}
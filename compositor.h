@@ -0,0 +1,82 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdint.h>
+#include "proto.h"
+#include "screen.h"
+
+#ifdef CONFIG_LCD_TRANSLATOR_MAX_CLIENTS
+#  define COMP_MAX_CLIENTS CONFIG_LCD_TRANSLATOR_MAX_CLIENTS
+#else
+#  define COMP_MAX_CLIENTS 3
+#endif
+
+#ifdef CONFIG_LCD_TRANSLATOR_ROTATE_MS
+#  define COMP_ROTATE_MS CONFIG_LCD_TRANSLATOR_ROTATE_MS
+#else
+#  define COMP_ROTATE_MS 5000
+#endif
+
+enum comp_mode {
+	/* Every client owns a slice of the display */
+	COMP_MODE_REGION,
+	/* Clients own the whole display, the one with the highest priority
+	 * is shown. Clients with the same priority are shown in turn. */
+	COMP_MODE_PRIORITY,
+};
+
+/* Zero based */
+struct comp_region {
+	uint8_t row;
+	uint8_t col;
+	uint8_t nrows;
+	uint8_t ncolumns;
+};
+
+typedef int (*comp_emit_t)(void *ctx, const struct proto_cmd_data *cmd);
+
+struct compositor;
+
+/* Commands for the display are passed to emit, only for the cells that
+ * changed since the previous flush.
+ */
+struct compositor *compositor_init(enum comp_mode mode, uint8_t nrows,
+				   uint8_t ncolumns, comp_emit_t emit, void *ctx);
+void compositor_deinit(struct compositor *comp);
+
+/* region is used in region mode only, priority in priority mode only (the
+ * higher the value the higher the priority).
+ * Return the client id or a negative errno.
+ */
+int compositor_add_client(struct compositor *comp,
+			  const struct comp_region *region, uint8_t priority);
+
+/* Feed bytes received from a client */
+void compositor_input(struct compositor *comp, int id, const uint8_t *buf,
+		      int len);
+
+/* Compose the clients screens and send the changes to the display.
+ * Return the ms after which it must be called again (rotation) or -1.
+ */
+int compositor_flush(struct compositor *comp);
+
+#endif /* COMPOSITOR_H */
@@ -0,0 +1,54 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include "utils.h"
+#include "ctrl.h"
+#include "ctrl_ansi.h"
+#include "ctrl_hd44780.h"
+#ifdef __NuttX__
+#  include "ctrl_slcd.h"
+#endif
+
+int ctrl_open(struct ctrl *lcd, const char *client_port,
+	      const struct charset *cs)
+{
+	if (!strncmp(client_port, "i2c:", 4)) {
+		lcd->hndl = ctrl_hd44780_init(client_port + 4, cs);
+		lcd->ops = &ctrl_hd44780_ops;
+	} else if (!strncmp(client_port, "ansi:", 5)) {
+		lcd->hndl = ctrl_ansi_init(client_port + 5);
+		lcd->ops = &ctrl_ansi_ops;
+	} else {
+#ifdef __NuttX__
+		lcd->hndl = ctrl_slcd_init(client_port, cs);
+		lcd->ops = &ctrl_slcd_ops;
+#else
+		lcd->hndl = ctrl_ansi_init(client_port);
+		lcd->ops = &ctrl_ansi_ops;
+#endif
+	}
+	if (!lcd->hndl) {
+		error("display init fail: %s\n", client_port);
+		return -ENODEV;
+	}
+	return 0;
+}
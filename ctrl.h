@@ -0,0 +1,50 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CTRL_H
+#define CTRL_H
+
+#include <stdint.h>
+#include "proto.h"
+#include "charset.h"
+
+/* Display controllers, the output side of the translator */
+struct ctrl_ops {
+	int (*cmd)(void *hndl, const struct proto_cmd_data *cmd);
+	/* Send the pending output. Return the ms after which it must be
+	 * called again or -1. */
+	int (*flush)(void *hndl);
+	void (*geometry)(void *hndl, uint8_t *nrows, uint8_t *ncolumns);
+	int (*deinit)(void *hndl);
+};
+
+struct ctrl {
+	void *hndl;
+	const struct ctrl_ops *ops;
+};
+
+/* Open the display behind a client port: "i2c:<spec>" drives a PCF8574
+ * backpack directly, "ansi:<spec>" draws on a terminal, anything else is
+ * the slcd driver (a terminal on Linux). cs is copied, NULL for the
+ * default.
+ */
+int ctrl_open(struct ctrl *lcd, const char *client_port,
+	      const struct charset *cs);
+
+#endif /* CTRL_H */
@@ -0,0 +1,381 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "ctrl_ansi.h"
+#include "screen.h"
+#include "lcd_geometry.h"
+
+/* A full redraw of the biggest screen, custom chars included */
+#define ANSI_BUFSIZE 4096
+
+#ifdef LCD_FIXED_GEOMETRY
+#  define ANSI_NROWS LCD_MAX_NROWS
+#  define ANSI_NCOLUMNS LCD_MAX_NCOLUMNS
+#else
+#  define ANSI_NROWS 4
+#  define ANSI_NCOLUMNS 20
+#endif
+
+/* Terminal position of a cell, one based, inside the box */
+#define ANSI_ROW(r) ((r) + 2)
+#define ANSI_COL(c) ((c) + 2)
+
+#define CSI "\033["
+
+struct ctrl_ansi {
+	int fd;
+	uint8_t nrows;
+	uint8_t ncolumns;
+	/* What the client asked for, and what the terminal shows */
+	struct screen scr;
+	struct screen shown;
+	int shown_valid;
+	int dirty;
+	/* Terminal state: cursor (0 if unknown), reverse video, cursor
+	 * visibility (-1 unknown) */
+	int trow;
+	int tcol;
+	int reverse;
+	int cursor;
+
+	char out[ANSI_BUFSIZE];
+	int nout;
+	struct ansi_stats st;
+};
+
+static void ansi_write(struct ctrl_ansi *priv)
+{
+	const char *p = priv->out;
+	int len = priv->nout, ret;
+
+	priv->nout = 0;
+	if (!len)
+		return;
+	priv->st.frames++;
+	priv->st.bytes += len;
+	while (len > 0) {
+		ret = write(priv->fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			error("ansi: write err: %d\n", -errno);
+			priv->st.errors++;
+			/* Nothing is known about the terminal any more */
+			priv->shown_valid = 0;
+			return;
+		}
+		p += ret;
+		len -= ret;
+	}
+}
+
+static void ansi_emit(struct ctrl_ansi *priv, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(&priv->out[priv->nout], ANSI_BUFSIZE - priv->nout, fmt, ap);
+	va_end(ap);
+	if (priv->nout + n >= ANSI_BUFSIZE) {
+		/* Never with the screen sizes supported, a frame just takes
+		 * two writes */
+		ansi_write(priv);
+		va_start(ap, fmt);
+		n = vsnprintf(priv->out, ANSI_BUFSIZE, fmt, ap);
+		va_end(ap);
+	}
+	priv->nout += n;
+}
+
+static int ansi_ndigits(int v)
+{
+	return v >= 100 ? 3 : v >= 10 ? 2 : 1;
+}
+
+static int ansi_is_glyph(uint8_t ch)
+{
+	return ch < SCREEN_NGLYPHS;
+}
+
+/* Bytes of a cell once on the terminal, reverse video toggle excluded */
+static int ansi_cell_len(uint8_t ch)
+{
+	/* Latin-1 is sent as UTF-8 */
+	return ch >= 0xa0 ? 2 : 1;
+}
+
+static void ansi_reverse(struct ctrl_ansi *priv, int on)
+{
+	if (priv->reverse == on)
+		return;
+	ansi_emit(priv, on ? CSI "7m" : CSI "27m");
+	priv->reverse = on;
+}
+
+static void ansi_putc(struct ctrl_ansi *priv, uint8_t r, uint8_t c)
+{
+	uint8_t ch = priv->scr.cells[r][c];
+
+	ansi_reverse(priv, ansi_is_glyph(ch));
+	if (ansi_is_glyph(ch))
+		ansi_emit(priv, "%c", '0' + ch);
+	else if (ch >= 0xa0)
+		ansi_emit(priv, "%c%c", 0xc0 | (ch >> 6), 0x80 | (ch & 0x3f));
+	else if (ch >= 0x20 && ch < 0x7f)
+		ansi_emit(priv, "%c", ch);
+	else
+		ansi_emit(priv, "?");
+	priv->shown.cells[r][c] = ch;
+	priv->tcol++;
+}
+
+/* Bring the terminal cursor to the cell r, c with the fewest bytes:
+ * nothing, rewriting the cells in between, cursor forward or cursor
+ * position. */
+static void ansi_goto(struct ctrl_ansi *priv, uint8_t r, uint8_t c)
+{
+	int row = ANSI_ROW(r), col = ANSI_COL(c);
+	int cup, cuf, gap = 0, i;
+
+	if (priv->trow == row && priv->tcol == col)
+		return;
+	cup = 4 + ansi_ndigits(row) + ansi_ndigits(col);
+	if (priv->trow == row && priv->tcol >= ANSI_COL(0) && priv->tcol < col) {
+		cuf = col - priv->tcol == 1 ? 3 : 3 + ansi_ndigits(col - priv->tcol);
+		/* The cells in between are unchanged, custom chars are not
+		 * worth the reverse video toggles */
+		for (i = priv->tcol - ANSI_COL(0); i < c; i++) {
+			if (ansi_is_glyph(priv->scr.cells[r][i])) {
+				gap = cup;
+				break;
+			}
+			gap += ansi_cell_len(priv->scr.cells[r][i]);
+		}
+		if (priv->reverse)
+			gap += 5;
+		if (gap < cuf && gap < cup) {
+			for (i = priv->tcol - ANSI_COL(0); i < c; i++)
+				ansi_putc(priv, r, i);
+			return;
+		}
+		if (cuf < cup) {
+			if (col - priv->tcol == 1)
+				ansi_emit(priv, CSI "C");
+			else
+				ansi_emit(priv, CSI "%dC", col - priv->tcol);
+			priv->tcol = col;
+			return;
+		}
+	}
+	ansi_emit(priv, CSI "%d;%dH", row, col);
+	priv->trow = row;
+	priv->tcol = col;
+}
+
+/* Clear the terminal and draw the box, the cells are left blank */
+static void ansi_frame(struct ctrl_ansi *priv)
+{
+	int r, c;
+
+	ansi_emit(priv, CSI "0m" CSI "H" CSI "2J+");
+	for (c = 0; c < priv->ncolumns; c++)
+		ansi_emit(priv, "-");
+	ansi_emit(priv, "+");
+	for (r = 0; r < priv->nrows; r++)
+		ansi_emit(priv, CSI "%d;1H|" CSI "%dC|", ANSI_ROW(r),
+			  priv->ncolumns);
+	ansi_emit(priv, CSI "%d;1H+", ANSI_ROW(priv->nrows));
+	for (c = 0; c < priv->ncolumns; c++)
+		ansi_emit(priv, "-");
+	ansi_emit(priv, "+");
+
+	screen_clear(&priv->shown);
+	priv->shown_valid = 1;
+	priv->trow = 0;
+	priv->tcol = 0;
+	priv->reverse = 0;
+	priv->cursor = -1;
+}
+
+static void ansi_render(struct ctrl_ansi *priv)
+{
+	const struct screen *scr = &priv->scr;
+	int r, c, cursor;
+
+	if (!priv->shown_valid)
+		ansi_frame(priv);
+	for (r = 0; r < priv->nrows; r++) {
+		for (c = 0; c < priv->ncolumns; c++) {
+			if (scr->cells[r][c] == priv->shown.cells[r][c])
+				continue;
+			ansi_goto(priv, r, c);
+			ansi_putc(priv, r, c);
+		}
+	}
+	/* Leave the terminal in plain video, logs might go to it */
+	ansi_reverse(priv, 0);
+
+	cursor = !!(scr->flags & (SCREEN_F_UNDERLINE | SCREEN_F_BLINK));
+	if (cursor)
+		ansi_goto(priv, scr->row, scr->col);
+	if (cursor != priv->cursor)
+		ansi_emit(priv, cursor ? CSI "?25h" : CSI "?25l");
+	priv->cursor = cursor;
+	ansi_write(priv);
+}
+
+/* <tty>[:<columns>x<rows>] */
+static int ansi_parse_spec(struct ctrl_ansi *priv, const char *spec,
+			   char *dev, int dev_len)
+{
+	const char *p = spec + strcspn(spec, ":");
+	unsigned int nc = ANSI_NCOLUMNS, nr = ANSI_NROWS;
+
+	if (p - spec >= dev_len)
+		return -ENAMETOOLONG;
+	memcpy(dev, spec, p - spec);
+	dev[p - spec] = '\0';
+	if (*p == ':' && sscanf(p + 1, "%ux%u", &nc, &nr) != 2)
+		return -EINVAL;
+	if (!nr || nr > LCD_MAX_NROWS || !nc || nc > LCD_MAX_NCOLUMNS)
+		return -EINVAL;
+#ifdef LCD_FIXED_GEOMETRY
+	if (nr != LCD_MAX_NROWS || nc != LCD_MAX_NCOLUMNS)
+		return -EINVAL;
+#endif
+	priv->nrows = nr;
+	priv->ncolumns = nc;
+	return 0;
+}
+
+struct ctrl_ansi *ctrl_ansi_init(const char *spec)
+{
+	struct ctrl_ansi *priv;
+	char dev[32];
+	int ret;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return NULL;
+
+	ret = ansi_parse_spec(priv, spec, dev, sizeof(dev));
+	if (ret < 0) {
+		error("ansi: bad spec %s\n", spec);
+		goto exit_alloc;
+	}
+	if (!strcmp(dev, ANSI_STDOUT)) {
+		priv->fd = STDOUT_FILENO;
+	} else {
+		priv->fd = open(dev, O_WRONLY | O_NOCTTY);
+		if (priv->fd < 0) {
+			ret = -errno;
+			goto exit_alloc;
+		}
+	}
+
+	screen_init(&priv->scr, priv->nrows, priv->ncolumns);
+	screen_init(&priv->shown, priv->nrows, priv->ncolumns);
+	ansi_render(priv);
+	info("ansi: %dx%d on %s\n", priv->ncolumns, priv->nrows, dev);
+	return priv;
+
+exit_alloc:
+	free(priv);
+	error("ansi init err: %d\n", ret);
+	return NULL;
+}
+
+int ctrl_ansi_deinit(struct ctrl_ansi *hndl)
+{
+	if (!hndl)
+		return -EINVAL;
+	/* Give the terminal back below the box */
+	ansi_emit(hndl, CSI "0m" CSI "%d;1H" CSI "?25h\n",
+		  ANSI_ROW(hndl->nrows));
+	ansi_write(hndl);
+	if (hndl->fd != STDOUT_FILENO)
+		close(hndl->fd);
+	free(hndl);
+	return 0;
+}
+
+int ctrl_ansi_cmd(struct ctrl_ansi *hndl, const struct proto_cmd_data *cmd)
+{
+	/* Backlight, contrast and GPOs have nothing to act on */
+	if (screen_apply(&hndl->scr, cmd))
+		hndl->dirty = 1;
+	return 0;
+}
+
+int ctrl_ansi_flush(struct ctrl_ansi *hndl)
+{
+	if (hndl->dirty || !hndl->shown_valid)
+		ansi_render(hndl);
+	hndl->dirty = 0;
+	return -1;
+}
+
+void ctrl_ansi_geometry(struct ctrl_ansi *hndl, uint8_t *nrows,
+			uint8_t *ncolumns)
+{
+	*nrows = hndl->nrows;
+	*ncolumns = hndl->ncolumns;
+}
+
+void ctrl_ansi_stats(struct ctrl_ansi *hndl, struct ansi_stats *st)
+{
+	*st = hndl->st;
+}
+
+static int ansi_op_cmd(void *hndl, const struct proto_cmd_data *cmd)
+{
+	return ctrl_ansi_cmd(hndl, cmd);
+}
+
+static int ansi_op_flush(void *hndl)
+{
+	return ctrl_ansi_flush(hndl);
+}
+
+static void ansi_op_geometry(void *hndl, uint8_t *nrows, uint8_t *ncolumns)
+{
+	ctrl_ansi_geometry(hndl, nrows, ncolumns);
+}
+
+static int ansi_op_deinit(void *hndl)
+{
+	return ctrl_ansi_deinit(hndl);
+}
+
+const struct ctrl_ops ctrl_ansi_ops = {
+	.cmd = ansi_op_cmd,
+	.flush = ansi_op_flush,
+	.geometry = ansi_op_geometry,
+	.deinit = ansi_op_deinit,
+};
@@ -0,0 +1,56 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CTRL_ANSI_H
+#define CTRL_ANSI_H
+
+#include <stdint.h>
+#include "proto.h"
+#include "ctrl.h"
+
+/* Name of the tty for the standard output */
+#define ANSI_STDOUT "-"
+
+struct ansi_stats {
+	/* Frames written, one write() each, and their bytes */
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t errors;
+};
+
+struct ctrl_ansi;
+
+extern const struct ctrl_ops ctrl_ansi_ops;
+
+/* A terminal as display: the screen is drawn in a box at the top left
+ * corner, custom chars are shown as their index in reverse video.
+ * spec: <tty>[:<columns>x<rows>], ANSI_STDOUT for the standard output.
+ */
+struct ctrl_ansi *ctrl_ansi_init(const char *spec);
+int ctrl_ansi_deinit(struct ctrl_ansi *hndl);
+/* Only updates the model of the screen, see ctrl_ansi_flush() */
+int ctrl_ansi_cmd(struct ctrl_ansi *hndl, const struct proto_cmd_data *cmd);
+/* Write the cells that changed since the last call with the shortest
+ * escape sequences, in a single write(). Return -1. */
+int ctrl_ansi_flush(struct ctrl_ansi *hndl);
+void ctrl_ansi_geometry(struct ctrl_ansi *hndl, uint8_t *nrows,
+			uint8_t *ncolumns);
+void ctrl_ansi_stats(struct ctrl_ansi *hndl, struct ansi_stats *st);
+
+#endif /* CTRL_ANSI_H */
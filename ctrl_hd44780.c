@@ -0,0 +1,709 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __NuttX__
+#  include <nuttx/i2c/i2c_master.h>
+#else
+#  include <linux/i2c.h>
+#  include <linux/i2c-dev.h>
+#endif
+
+#include "utils.h"
+#include "ctrl_hd44780.h"
+#include "screen.h"
+#include "snapshot.h"
+#include "lcd_geometry.h"
+
+/* PCF8574 pins, the common backpack wiring */
+#define PCF_RS 0x01
+#define PCF_RW 0x02
+#define PCF_E  0x04
+#define PCF_BL 0x08
+
+/* HD44780 instructions */
+#define HD_CLEAR    0x01
+#define HD_HOME     0x02
+#define HD_ENTRY    0x04
+#define HD_ENTRY_INC 0x02
+#define HD_SHIFT    0x10
+#define HD_SHIFT_DISPLAY 0x08
+#define HD_SHIFT_RIGHT   0x04
+#define HD_DISPLAY  0x08
+#define HD_DISPLAY_ON 0x04
+#define HD_CURSOR_ON  0x02
+#define HD_BLINK_ON   0x01
+#define HD_FUNCTION 0x20
+#define HD_FUNCTION_2LINES 0x08
+#define HD_CGRAM    0x40
+#define HD_DDRAM    0x80
+
+/* Clear and home take 1.52 ms, the rest less than a byte on the bus */
+#define HD_SLOW_US 2000
+/* Chars written in the time of a clear, at 100 kHz */
+#define HD_CLEAR_CELLS 4
+
+/* Expander bytes per I2C transfer: up to 32 chars */
+#define HD_XFER_MAX 128
+#define HD_RESYNC_MS 100
+
+/* DDRAM cells of each of the two lines, the display shows a window on
+ * them that can be shifted. */
+#define HD_LINE_LEN 40
+#define HD_SHIFT_UNKNOWN 0xff
+
+#ifdef LCD_FIXED_GEOMETRY
+#  define HD_NROWS LCD_MAX_NROWS
+#  define HD_NCOLUMNS LCD_MAX_NCOLUMNS
+#else
+#  define HD_NROWS 4
+#  define HD_NCOLUMNS 20
+#endif
+
+/* Emulated controller, fed with the expander bytes */
+struct hd_mock {
+	uint8_t last;
+	int four_bit;
+	int have_hi;
+	uint8_t hi;
+	int cgram;
+	uint8_t ac;
+	uint8_t shift;
+	uint8_t ddram[128];
+	uint8_t cgram_data[64];
+};
+
+struct ctrl_hd44780 {
+	int fd;
+	uint8_t addr;
+	struct hd_mock *mock;
+	uint8_t nrows;
+	uint8_t ncolumns;
+	uint8_t row_addr[4];
+
+	/* Expander bytes waiting for the next transfer */
+	uint8_t out[HD_XFER_MAX];
+	int nout;
+	/* Last RS level on the expander, -1 unknown */
+	int rs;
+	uint8_t bl;
+	uint8_t display;
+	/* Address counter, -1 if not on a known DDRAM cell */
+	int hw_row;
+	int hw_col;
+	/* DDRAM content (as written, after charset_map) and display shift.
+	 * Shifting is only done when each row has a DDRAM line of its own. */
+	uint8_t ddram[2][HD_LINE_LEN];
+	uint8_t shift;
+	/* A transfer failed: what the display shows is unknown */
+	int resync;
+
+	struct charset cs;
+	/* What the client asked for, and what was rendered last (custom
+	 * chars are the ones in CGRAM) */
+	struct screen scr;
+	struct screen hw;
+	int dirty;
+	/* scr changed since it was published */
+	int unpublished;
+	struct snapshot *snap;
+	struct hd44780_stats st;
+};
+
+/* Mock adapter */
+
+static void hd_mock_exec(struct hd_mock *m, int rs, uint8_t b)
+{
+	if (rs) {
+		if (m->cgram)
+			m->cgram_data[m->ac++ & 0x3f] = b;
+		else
+			m->ddram[m->ac++ & 0x7f] = b;
+		return;
+	}
+	if (b & HD_DDRAM) {
+		m->ac = b & 0x7f;
+		m->cgram = 0;
+	} else if (b & HD_CGRAM) {
+		m->ac = b & 0x3f;
+		m->cgram = 1;
+	} else if (b == HD_CLEAR) {
+		memset(m->ddram, ' ', sizeof(m->ddram));
+		m->ac = 0;
+		m->cgram = 0;
+	} else if ((b & ~1) == HD_HOME) {
+		m->ac = 0;
+		m->cgram = 0;
+		m->shift = 0;
+	} else if ((b & 0xf8) == (HD_SHIFT | HD_SHIFT_DISPLAY)) {
+		m->shift = (m->shift + (b & HD_SHIFT_RIGHT ? -1 : 1) +
+			    HD_LINE_LEN) % HD_LINE_LEN;
+	}
+}
+
+static void hd_mock_feed(struct hd_mock *m, const uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		/* The controller latches on the falling edge of E */
+		if ((m->last & PCF_E) && !(buf[i] & PCF_E)) {
+			uint8_t nib = m->last >> 4;
+			int rs = m->last & PCF_RS;
+
+			if (!m->four_bit) {
+				/* Function set, the low nibble is not wired */
+				if ((nib << 4) == HD_FUNCTION)
+					m->four_bit = 1;
+			} else if (!m->have_hi) {
+				m->hi = nib;
+				m->have_hi = 1;
+			} else {
+				hd_mock_exec(m, rs, (m->hi << 4) | nib);
+				m->have_hi = 0;
+			}
+		}
+		m->last = buf[i];
+	}
+}
+
+/* Bus */
+
+static int hd_xfer(struct ctrl_hd44780 *priv)
+{
+	int ret = 0;
+
+	if (!priv->nout)
+		return 0;
+	priv->st.xfers++;
+	priv->st.bytes += priv->nout;
+
+	if (priv->mock) {
+		hd_mock_feed(priv->mock, priv->out, priv->nout);
+	} else {
+#ifdef __NuttX__
+		struct i2c_msg_s msg = {
+			.frequency = HD44780_I2C_FREQ,
+			.addr = priv->addr,
+			.flags = 0,
+			.buffer = priv->out,
+			.length = priv->nout,
+		};
+		struct i2c_transfer_s xfer = { .msgv = &msg, .msgc = 1 };
+
+		ret = ioctl(priv->fd, I2CIOC_TRANSFER, (unsigned long)&xfer);
+#else
+		struct i2c_msg msg = {
+			.addr = priv->addr,
+			.flags = 0,
+			.len = priv->nout,
+			.buf = priv->out,
+		};
+		struct i2c_rdwr_ioctl_data xfer = { .msgs = &msg, .nmsgs = 1 };
+
+		ret = ioctl(priv->fd, I2C_RDWR, &xfer);
+#endif
+		if (ret < 0) {
+			ret = -errno;
+			error("hd44780: i2c transfer failed: %d\n", ret);
+			priv->st.errors++;
+			priv->resync = 1;
+		}
+	}
+	priv->nout = 0;
+	return ret;
+}
+
+static void hd_push(struct ctrl_hd44780 *priv, uint8_t v)
+{
+	if (priv->nout >= HD_XFER_MAX)
+		hd_xfer(priv);
+	priv->out[priv->nout++] = v;
+}
+
+/* A nibble is latched by an E strobe. RS gets its own byte only when it
+ * changes, the data lines settle well before E falls. */
+static void hd_nibble(struct ctrl_hd44780 *priv, uint8_t nib, int rs)
+{
+	uint8_t v = (nib << 4) | priv->bl | (rs ? PCF_RS : 0);
+
+	if (priv->rs != rs)
+		hd_push(priv, v);
+	priv->rs = rs;
+	hd_push(priv, v | PCF_E);
+	hd_push(priv, v);
+}
+
+static void hd_write(struct ctrl_hd44780 *priv, uint8_t b, int rs)
+{
+	hd_nibble(priv, b >> 4, rs);
+	hd_nibble(priv, b & 0x0f, rs);
+	if (rs)
+		priv->st.data++;
+	else
+		priv->st.instrs++;
+}
+
+static void hd_instr_slow(struct ctrl_hd44780 *priv, uint8_t instr)
+{
+	hd_write(priv, instr, 0);
+	hd_xfer(priv);
+	if (!priv->mock)
+		usleep(HD_SLOW_US);
+	priv->hw_row = 0;
+	priv->hw_col = 0;
+}
+
+/* Rendering */
+
+/* DDRAM address of r, c with the display shifted by shift */
+static uint8_t hd_addr(const struct ctrl_hd44780 *priv, uint8_t r, uint8_t c,
+		       uint8_t shift)
+{
+	uint8_t line = priv->row_addr[r] & 0x40;
+
+	return line | (((priv->row_addr[r] & 0x3f) + c + shift) % HD_LINE_LEN);
+}
+
+static uint8_t *hd_ddram(struct ctrl_hd44780 *priv, uint8_t addr)
+{
+	return &priv->ddram[addr >> 6][addr & 0x3f];
+}
+
+static void hd_clear(struct ctrl_hd44780 *priv)
+{
+	hd_instr_slow(priv, HD_CLEAR);
+	/* Only return home is documented to undo the shift */
+	if (priv->shift)
+		hd_instr_slow(priv, HD_HOME);
+	priv->shift = 0;
+	memset(priv->ddram, ' ', sizeof(priv->ddram));
+	screen_clear(&priv->hw);
+}
+
+static void hd_goto(struct ctrl_hd44780 *priv, uint8_t r, uint8_t c)
+{
+	if (priv->hw_row == r && priv->hw_col == c)
+		return;
+	hd_write(priv, HD_DDRAM | hd_addr(priv, r, c, priv->shift), 0);
+	priv->hw_row = r;
+	priv->hw_col = c;
+}
+
+/* Write the mapped char ch at r, c */
+static void hd_putc(struct ctrl_hd44780 *priv, uint8_t r, uint8_t c,
+		    uint8_t ch)
+{
+	uint8_t addr = hd_addr(priv, r, c, priv->shift);
+
+	hd_goto(priv, r, c);
+	hd_write(priv, ch, 1);
+	*hd_ddram(priv, addr) = ch;
+	priv->hw_col++;
+	/* The address counter goes on to the other line */
+	if ((addr & 0x3f) == HD_LINE_LEN - 1)
+		priv->hw_row = -1;
+}
+
+/* Cells that would need a write for the display to show want (mapped
+ * chars) with the display shifted by shift */
+static int hd_mismatch(struct ctrl_hd44780 *priv,
+		       const uint8_t (*want)[LCD_MAX_NCOLUMNS], uint8_t shift)
+{
+	int r, c, n = 0;
+
+	for (r = 0; r < priv->nrows; r++) {
+		for (c = 0; c < priv->ncolumns; c++)
+			n += *hd_ddram(priv, hd_addr(priv, r, c, shift)) != want[r][c];
+	}
+	return n;
+}
+
+static void hd_create_char(struct ctrl_hd44780 *priv, uint8_t idx,
+			   const uint8_t *bmp)
+{
+	int i;
+
+	hd_write(priv, HD_CGRAM | ((idx & 7) << 3), 0);
+	for (i = 0; i < 8; i++)
+		hd_write(priv, bmp[i], 1);
+	priv->hw_row = -1;
+	memcpy(priv->hw.glyphs[idx & 7], bmp, 8);
+	priv->hw.glyph_mask |= 1 << (idx & 7);
+}
+
+static void hd_set_display(struct ctrl_hd44780 *priv)
+{
+	uint8_t display = HD_DISPLAY | HD_DISPLAY_ON;
+
+	if (priv->scr.flags & SCREEN_F_UNDERLINE)
+		display |= HD_CURSOR_ON;
+	if (priv->scr.flags & SCREEN_F_BLINK)
+		display |= HD_BLINK_ON;
+	if (display != priv->display)
+		hd_write(priv, display, 0);
+	priv->display = display;
+}
+
+/* A scrolling widget resends its row moved by one column: shifting the
+ * display and writing the edge costs less than the whole row. Shifting
+ * moves all the rows, the others must stay right or be cheap to fix.
+ * Return the cells to write with the best shift, found in *shift. */
+static int hd_plan_shift(struct ctrl_hd44780 *priv,
+			 const uint8_t (*want)[LCD_MAX_NCOLUMNS], uint8_t *shift)
+{
+	int best, cost, dir, r;
+	uint8_t s;
+
+	*shift = priv->shift;
+	best = hd_mismatch(priv, want, priv->shift);
+	/* Rows 2 and 3 share the DDRAM lines with rows 0 and 1 */
+	if (priv->nrows > 2)
+		return best;
+	for (r = 0; r < priv->nrows; r++) {
+		dir = screen_shift(&priv->hw, r, 0, priv->scr.cells[r],
+				   priv->ncolumns);
+		if (!dir)
+			continue;
+		s = (priv->shift + dir + HD_LINE_LEN) % HD_LINE_LEN;
+		/* One instruction, a data write costs the same */
+		cost = hd_mismatch(priv, want, s) + 1;
+		if (cost < best) {
+			best = cost;
+			*shift = s;
+		}
+	}
+	return best;
+}
+
+/* Bring the display to what scr says, only the cells that differ are
+ * written. */
+static void hd_render(struct ctrl_hd44780 *priv)
+{
+	const struct screen *scr = &priv->scr;
+	uint8_t want[LCD_MAX_NROWS][LCD_MAX_NCOLUMNS];
+	const uint8_t *bmp;
+	uint8_t shift;
+	int r, c, nblank = 0;
+
+	for (c = 0; c < SCREEN_NGLYPHS; c++) {
+		if (scr->glyph_mask & (1 << c)) {
+			/* The client wins over the charset */
+			if (priv->cs.glyph_mask & (1 << c))
+				charset_release(&priv->cs, c);
+			bmp = scr->glyphs[c];
+		} else if (priv->cs.glyph_mask & (1 << c)) {
+			bmp = priv->cs.glyphs[c];
+		} else {
+			continue;
+		}
+		if (!(priv->hw.glyph_mask & (1 << c)) ||
+		    memcmp(priv->hw.glyphs[c], bmp, 8))
+			hd_create_char(priv, c, bmp);
+	}
+
+	for (r = 0; r < priv->nrows; r++) {
+		charset_map(&priv->cs, want[r], scr->cells[r], priv->ncolumns);
+		for (c = 0; c < priv->ncolumns; c++)
+			nblank += want[r][c] == ' ';
+	}
+	if (priv->nrows * priv->ncolumns - nblank + HD_CLEAR_CELLS <
+	    hd_plan_shift(priv, want, &shift)) {
+		hd_clear(priv);
+		shift = 0;
+	}
+	if (shift != priv->shift) {
+		hd_write(priv, HD_SHIFT | HD_SHIFT_DISPLAY |
+			 (shift == (priv->shift + 1) % HD_LINE_LEN ?
+			  0 : HD_SHIFT_RIGHT), 0);
+		priv->shift = shift;
+		priv->hw_row = -1;
+		priv->st.shifts++;
+	}
+	for (r = 0; r < priv->nrows; r++) {
+		for (c = 0; c < priv->ncolumns; c++) {
+			if (*hd_ddram(priv, hd_addr(priv, r, c, shift)) == want[r][c])
+				continue;
+			/* A char left as it is costs one data write, moving the
+			 * address counter takes an instruction and two RS changes */
+			if (priv->hw_row == r && priv->hw_col == c - 1)
+				hd_putc(priv, r, c - 1, want[r][c - 1]);
+			hd_putc(priv, r, c, want[r][c]);
+		}
+	}
+	memcpy(priv->hw.cells, scr->cells, sizeof(scr->cells));
+
+	hd_set_display(priv);
+	/* The cursor might be visible: leave it where the client put it */
+	if (priv->display & (HD_CURSOR_ON | HD_BLINK_ON))
+		hd_goto(priv, scr->row, scr->col);
+	hd_xfer(priv);
+}
+
+static int hd_init_display(struct ctrl_hd44780 *priv)
+{
+	int i;
+
+	/* Reset by instruction, in 8 bit mode */
+	usleep(50 * 1000);
+	priv->rs = -1;
+	for (i = 0; i < 3; i++) {
+		hd_nibble(priv, 0x3, 0);
+		if (hd_xfer(priv) < 0)
+			return -EIO;
+		usleep(i ? 150 : 4500);
+	}
+	hd_nibble(priv, HD_FUNCTION >> 4, 0);
+	hd_write(priv, HD_FUNCTION | HD_FUNCTION_2LINES, 0);
+	priv->display = HD_DISPLAY | HD_DISPLAY_ON;
+	hd_write(priv, priv->display, 0);
+	hd_write(priv, HD_ENTRY | HD_ENTRY_INC, 0);
+	/* Left by a previous run maybe */
+	priv->shift = HD_SHIFT_UNKNOWN;
+	hd_clear(priv);
+	return priv->resync ? -EIO : 0;
+}
+
+/* A failed transfer might be a brown-out, which leaves the controller in 8
+ * bit mode: set it up again, then CGRAM, cells and cursor from the model. */
+static void hd_redraw(struct ctrl_hd44780 *priv)
+{
+	priv->resync = 0;
+	if (hd_init_display(priv) < 0)
+		return;
+	priv->hw.glyph_mask = 0;
+	hd_render(priv);
+}
+
+/* <dev>[@addr][:<columns>x<rows>] */
+static int hd_parse_spec(struct ctrl_hd44780 *priv, const char *spec,
+			 char *dev, int dev_len)
+{
+	const char *p = spec + strcspn(spec, "@:");
+	unsigned int addr = HD44780_I2C_ADDR, nc = HD_NCOLUMNS, nr = HD_NROWS;
+
+	if (p - spec >= dev_len)
+		return -ENAMETOOLONG;
+	memcpy(dev, spec, p - spec);
+	dev[p - spec] = '\0';
+	if (*p == '@' && sscanf(p + 1, "%x", &addr) != 1)
+		return -EINVAL;
+	p = strchr(p, ':');
+	if (p && sscanf(p + 1, "%ux%u", &nc, &nr) != 2)
+		return -EINVAL;
+	if (addr > 0x7f || !nr || nr > 4 || nr > LCD_MAX_NROWS ||
+	    !nc || nc > LCD_MAX_NCOLUMNS || nr * nc > LCD_HD44780_CELLS)
+		return -EINVAL;
+#ifdef LCD_FIXED_GEOMETRY
+	if (nr != LCD_MAX_NROWS || nc != LCD_MAX_NCOLUMNS)
+		return -EINVAL;
+#endif
+	priv->addr = addr;
+	priv->nrows = nr;
+	priv->ncolumns = nc;
+	return 0;
+}
+
+struct ctrl_hd44780 *ctrl_hd44780_init(const char *spec,
+				       const struct charset *cs)
+{
+	struct ctrl_hd44780 *priv;
+	char dev[32];
+	int ret;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return NULL;
+	priv->fd = -1;
+
+	ret = hd_parse_spec(priv, spec, dev, sizeof(dev));
+	if (ret < 0) {
+		error("hd44780: bad spec %s\n", spec);
+		goto exit_alloc;
+	}
+
+	if (!strcmp(dev, HD44780_MOCK_DEV)) {
+		priv->mock = calloc(1, sizeof(*priv->mock));
+		if (!priv->mock) {
+			ret = -ENOMEM;
+			goto exit_alloc;
+		}
+	} else {
+		priv->fd = open(dev, O_RDWR);
+		if (priv->fd < 0) {
+			ret = -errno;
+			goto exit_alloc;
+		}
+	}
+
+	/* Rows 2 and 3 continue rows 0 and 1 in DDRAM */
+	priv->row_addr[0] = 0x00;
+	priv->row_addr[1] = 0x40;
+	priv->row_addr[2] = priv->ncolumns;
+	priv->row_addr[3] = 0x40 + priv->ncolumns;
+	priv->bl = PCF_BL;
+
+	if (cs)
+		priv->cs = *cs;
+	else
+		charset_init(&priv->cs, CHARSET_DEFAULT);
+	screen_init(&priv->scr, priv->nrows, priv->ncolumns);
+	screen_init(&priv->hw, priv->nrows, priv->ncolumns);
+
+	ret = hd_init_display(priv);
+	if (ret < 0) {
+		error("hd44780: no display at 0x%02x\n", priv->addr);
+		goto exit_open;
+	}
+	/* Charset glyphs */
+	hd_render(priv);
+
+	info("hd44780: %dx%d at 0x%02x on %s\n", priv->ncolumns, priv->nrows,
+	     priv->addr, dev);
+
+#ifdef CONFIG_LCD_TRANSLATOR_SNAPSHOT
+	priv->snap = snapshot_init(SNAPSHOT_SHM_NAME);
+	if (!priv->snap)
+		error("screen snapshots not available\n");
+	else
+		snapshot_publish(priv->snap, &priv->scr);
+#endif
+
+	return priv;
+
+exit_open:
+	if (priv->fd >= 0)
+		close(priv->fd);
+exit_alloc:
+	free(priv->mock);
+	free(priv);
+	error("hd44780 init err: %d\n", ret);
+	return NULL;
+}
+
+int ctrl_hd44780_deinit(struct ctrl_hd44780 *hndl)
+{
+	if (!hndl)
+		return -EINVAL;
+	hd_xfer(hndl);
+	snapshot_deinit(hndl->snap);
+	if (hndl->fd >= 0)
+		close(hndl->fd);
+	free(hndl->mock);
+	free(hndl);
+	return 0;
+}
+
+int ctrl_hd44780_cmd(struct ctrl_hd44780 *hndl, const struct proto_cmd_data *cmd)
+{
+	struct ctrl_hd44780 *priv = hndl;
+
+	switch (cmd->cmd) {
+	case PROTO_CMD_BACKLIGHT_ON:
+	case PROTO_CMD_BACKLIGHT_OFF:
+	case PROTO_CMD_BACKLIGHT_LVL:
+		/* The backpack can only switch it, any level means on */
+		priv->bl = cmd->cmd == PROTO_CMD_BACKLIGHT_OFF ? 0 : PCF_BL;
+		hd_push(priv, priv->bl);
+		priv->rs = 0;
+		break;
+	default:
+		/* The rest changes the model, rendered on flush */
+		break;
+	}
+
+	if (screen_apply(&priv->scr, cmd)) {
+		priv->dirty = 1;
+		priv->unpublished = 1;
+	}
+	return 0;
+}
+
+int ctrl_hd44780_flush(struct ctrl_hd44780 *hndl)
+{
+	struct ctrl_hd44780 *priv = hndl;
+
+	if (priv->dirty)
+		hd_render(priv);
+	else
+		hd_xfer(priv);
+	priv->dirty = 0;
+	if (priv->resync)
+		hd_redraw(priv);
+	/* Once per batch of commands, not on the input path */
+	if (priv->unpublished && priv->snap) {
+		snapshot_publish(priv->snap, &priv->scr);
+		priv->unpublished = 0;
+	}
+	return priv->resync ? HD_RESYNC_MS : -1;
+}
+
+void ctrl_hd44780_geometry(struct ctrl_hd44780 *hndl, uint8_t *nrows,
+			   uint8_t *ncolumns)
+{
+	*nrows = hndl->nrows;
+	*ncolumns = hndl->ncolumns;
+}
+
+void ctrl_hd44780_stats(struct ctrl_hd44780 *hndl, struct hd44780_stats *st)
+{
+	*st = hndl->st;
+}
+
+int ctrl_hd44780_mock_cell(struct ctrl_hd44780 *hndl, uint8_t r, uint8_t c)
+{
+	if (!hndl->mock || r >= hndl->nrows || c >= hndl->ncolumns)
+		return -1;
+	return hndl->mock->ddram[hd_addr(hndl, r, c, hndl->mock->shift)];
+}
+
+static int hd_op_cmd(void *hndl, const struct proto_cmd_data *cmd)
+{
+	return ctrl_hd44780_cmd(hndl, cmd);
+}
+
+static int hd_op_flush(void *hndl)
+{
+	return ctrl_hd44780_flush(hndl);
+}
+
+static void hd_op_geometry(void *hndl, uint8_t *nrows, uint8_t *ncolumns)
+{
+	ctrl_hd44780_geometry(hndl, nrows, ncolumns);
+}
+
+static int hd_op_deinit(void *hndl)
+{
+	return ctrl_hd44780_deinit(hndl);
+}
+
+const struct ctrl_ops ctrl_hd44780_ops = {
+	.cmd = hd_op_cmd,
+	.flush = hd_op_flush,
+	.geometry = hd_op_geometry,
+	.deinit = hd_op_deinit,
+};
@@ -0,0 +1,79 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CTRL_HD44780_H
+#define CTRL_HD44780_H
+
+#include <stdint.h>
+#include "proto.h"
+#include "charset.h"
+#include "ctrl.h"
+
+#ifdef CONFIG_LCD_TRANSLATOR_HD44780_ADDR
+#  define HD44780_I2C_ADDR CONFIG_LCD_TRANSLATOR_HD44780_ADDR
+#else
+#  define HD44780_I2C_ADDR 0x27
+#endif
+
+#ifdef CONFIG_LCD_TRANSLATOR_HD44780_FREQ
+#  define HD44780_I2C_FREQ CONFIG_LCD_TRANSLATOR_HD44780_FREQ
+#else
+#  define HD44780_I2C_FREQ 100000
+#endif
+
+/* Device name selecting the mock I2C adapter */
+#define HD44780_MOCK_DEV "mock"
+
+struct hd44780_stats {
+	/* I2C transactions and bytes sent to the PCF8574 */
+	uint32_t xfers;
+	uint32_t bytes;
+	/* Bytes written to the HD44780, data and instructions */
+	uint32_t data;
+	uint32_t instrs;
+	uint32_t errors;
+	/* Display shifts done in place of rewriting a scrolled row */
+	uint32_t shifts;
+};
+
+struct ctrl_hd44780;
+
+extern const struct ctrl_ops ctrl_hd44780_ops;
+
+/* HD44780 behind a PCF8574 I2C expander, driven through the I2C char
+ * device (NuttX /dev/i2cN or Linux i2c-dev).
+ * spec: <i2c dev>[@<addr>][:<columns>x<rows>], address in hex.
+ * cs is copied, NULL for CHARSET_DEFAULT.
+ */
+struct ctrl_hd44780 *ctrl_hd44780_init(const char *spec,
+				       const struct charset *cs);
+int ctrl_hd44780_deinit(struct ctrl_hd44780 *hndl);
+/* Only updates the model of the screen, the cells that changed are sent
+ * on ctrl_hd44780_flush() */
+int ctrl_hd44780_cmd(struct ctrl_hd44780 *hndl, const struct proto_cmd_data *cmd);
+int ctrl_hd44780_flush(struct ctrl_hd44780 *hndl);
+void ctrl_hd44780_geometry(struct ctrl_hd44780 *hndl, uint8_t *nrows,
+			   uint8_t *ncolumns);
+void ctrl_hd44780_stats(struct ctrl_hd44780 *hndl, struct hd44780_stats *st);
+
+/* Mock adapter only: the char the emulated controller shows at r, c
+ * (zero based), -1 with a real adapter. */
+int ctrl_hd44780_mock_cell(struct ctrl_hd44780 *hndl, uint8_t r, uint8_t c);
+
+#endif /* CTRL_HD44780_H */
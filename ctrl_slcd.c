@@ -32,8 +32,78 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "utils.h"
 #include "proto.h"
+#include "ctrl_slcd.h"
+#include "charset.h"
+#include "glyphs.h"
+#include "screen.h"
+#include "snapshot.h"
+#include "lcd_geometry.h"
+#include "writer.h"
 
-#define SLCD_BUFSIZE 256
+/* Room for a whole screen of text plus the escape sequences needed to
+ * position it. */
+#define SLCD_BUFSIZE (LCD_MAX_CELLS + 96)
+
+#ifdef LCD_FIXED_GEOMETRY
+#  define SLCD_NROWS(p) LCD_MAX_NROWS
+#  define SLCD_NCOLUMNS(p) LCD_MAX_NCOLUMNS
+#else
+#  define SLCD_NROWS(p) ((p)->attr.nrows)
+#  define SLCD_NCOLUMNS(p) ((p)->attr.ncolumns)
+#endif
+
+/* How often to check if a pending redraw can be queued */
+#define SLCD_RESYNC_MS 50
+/* Longest wait between checks while the writer is busy */
+#define SLCD_DEFER_MAX_MS 20
+
+/* Cursor readback checks must stay under 1/SLCD_CHECK_RATIO of the
+ * display time. They stop when this many in a row disagree even right
+ * after a redraw: the driver can't be trusted on where the cursor is. */
+#define SLCD_CHECK_RATIO 100
+#define SLCD_CHECK_FAILS 3
+
+/* Calibration rounds at init, and weight of the older estimate when a
+ * live timing is taken in (1/8 for the new one) */
+#define SLCD_CAL_ROUNDS 4
+#define SLCD_COST_WEIGHT 8
+
+/* What each display operation takes, ns. Measured at init and refined
+ * with the timings of the writer, it drives the rendering choices. */
+struct slcd_cost {
+	/* write() call, fixed part, and each char written */
+	uint32_t write_ns;
+	uint32_t byte_ns;
+	/* Cursor positioning to 0, 0, plus step for each row and column */
+	uint32_t curpos_ns;
+	uint32_t curpos_step_ns;
+	/* Each column of cursor right */
+	uint32_t right_ns;
+	uint32_t clear_ns;
+	/* Custom char upload */
+	uint32_t cgram_ns;
+	/* SLCDIOC_CURPOS, measured at init only */
+	uint32_t curpos_read_ns;
+	/* Live timings taken in */
+	uint32_t samples;
+};
+
+/* Output classes, the writer times each one separately */
+enum slcd_op {
+	SLCD_OP_TEXT,
+	SLCD_OP_CURPOS,
+	SLCD_OP_RIGHT,
+	SLCD_OP_CLEAR,
+	SLCD_OP_CGRAM,
+};
+
+/* How the cursor gets to the next cell to write */
+enum slcd_move {
+	SLCD_MOVE_NONE,
+	SLCD_MOVE_REWRITE,
+	SLCD_MOVE_RIGHT,
+	SLCD_MOVE_CURPOS,
+};
 
 /* NuttX interface */
 
@@ -44,8 +114,48 @@ struct ctrl_slcd {
 	struct lib_outstream_s stream;
 
 	int fd;
+	/* Kept to reopen the device */
+	char dev[32];
 	struct slcd_attributes_s attr;
 	uint8_t buffer[SLCD_BUFSIZE+1];
+	/* Class of the output in buffer */
+	int op;
+	/* Client chars to display ROM */
+	struct charset cs;
+	/* What the client asked for, published for monitoring */
+	struct screen scr;
+	struct snapshot *snap;
+	/* scr changed since the last render, and since it was published */
+	int dirty;
+	int unpublished;
+	/* scr through the charset, what the display must show */
+	uint8_t want[LCD_MAX_NROWS][LCD_MAX_NCOLUMNS];
+	/* What is on the display, valid unless a redraw is due: the bytes
+	 * sent, after the charset. The cursor position is unknown after
+	 * writing the last column. */
+	struct screen hw;
+	int hw_valid;
+	int hw_cursor;
+	/* Output is done by the writer thread, directly during calibration */
+	struct writer *writer;
+	/* Some output was dropped: the display must be redrawn from scr */
+	int resync;
+	/* The device failed or shows something else: reopen it and redraw */
+	int fault;
+	uint32_t faults;
+	/* Put the cursor where scr has it after the next render */
+	int restore_cursor;
+	/* Last cursor readback, a mismatch waiting to be read again, and
+	 * mismatches in a row */
+	uint32_t check_ms;
+	int check_retry;
+	int check_fails;
+	/* Cost model, and what was issued since it was last refined */
+	struct slcd_cost cost;
+	struct writer_class last[WRITER_NCLASS];
+	uint32_t curpos_n;
+	uint32_t curpos_steps;
+	uint32_t right_steps;
 };
 
 static void slcd_dumpbuffer(const uint8_t *buffer, unsigned int buflen)
@@ -85,34 +195,55 @@ static void slcd_dumpbuffer(const uint8_t *buffer, unsigned int buflen)
 	}
 }
 
+static int slcd_write(int fd, const uint8_t *buf, int len)
+{
+	int ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			error("slcd write err: %d\n", -errno);
+			return -errno;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Recovered on the next ctrl_slcd_flush() */
+static void slcd_fault(struct ctrl_slcd *priv, const char *why)
+{
+	if (!priv->fault) {
+		error("slcd: %s, display reset scheduled\n", why);
+		priv->faults++;
+	}
+	priv->fault = 1;
+}
+
 static int cbk_slcd_flush(struct lib_outstream_s *stream)
 {
 	struct ctrl_slcd *priv = (struct ctrl_slcd *)stream;
-	const uint8_t *buffer;
-	ssize_t nwritten;
-	ssize_t remaining;
 
-	/* From NuttX slcd example, not quite sure what to return when
-	 * it fails.
-	 */
+	//info("slcd buffer dump\n");
+	//slcd_dumpbuffer(priv->buffer, stream->nput);
 
-	remaining = stream->nput;
-	buffer = priv->buffer;
+	if (!stream->nput)
+		return OK;
 
-	//info("slcd buffer dump\n");
-	//slcd_dumpbuffer(buffer, remaining);
-
-	while (remaining > 0) {
-		nwritten = write(priv->fd, buffer, remaining);
-		if (nwritten < 0) {
-			if (errno != EINTR)
-				error("write failed: %d\n", -errno);
-			/* continue anyway... don't know how to signal error to NuttX lib */
-		}
-		else {
-			remaining -= nwritten;
-			buffer    += nwritten;
-		}
+	/* Never wait for the display. When the writer can't keep up, what
+	 * follows is dropped too (no out of order output) and the screen is
+	 * redrawn later. */
+	if (!priv->writer) {
+		if (slcd_write(priv->fd, priv->buffer, stream->nput) < 0)
+			slcd_fault(priv, "write failed");
+	} else if (!priv->resync &&
+		   writer_submit(priv->writer, priv->buffer, stream->nput,
+				 priv->op) < 0) {
+		dbg("slcd: writer queue full, redraw scheduled\n");
+		priv->resync = 1;
 	}
 
 	/* Reset the stream */
@@ -143,18 +274,505 @@ static void cbk_slcd_puts(struct lib_outstream_s *outstream, const char *str)
 		slcd_put((int)*str, outstream);
 }
 
+/* Output of different classes goes in different batches */
+static void slcd_op(struct ctrl_slcd *priv, int op)
+{
+	if (priv->op == op)
+		return;
+	cbk_slcd_flush(&priv->stream);
+	priv->op = op;
+}
+
 /* rows and cols are zero based */
 static void slcd_set_curpos(struct ctrl_slcd *hndl, uint8_t r, uint8_t c)
 {
 	struct ctrl_slcd *priv = hndl;
+	slcd_op(priv, SLCD_OP_CURPOS);
 	slcd_encode(SLCDCODE_HOME, 0, &priv->stream);
 	/* HACK:
 	 * Hardware cursor seems to jump by one line on 20x2 display controllers,
 	 * so to be sure to go up to the first row, just double the jump */
-	slcd_encode(SLCDCODE_UP, priv->attr.nrows*2, &priv->stream);
+	slcd_encode(SLCDCODE_UP, SLCD_NROWS(priv)*2, &priv->stream);
 	cbk_slcd_flush(&priv->stream);
 	slcd_encode(SLCDCODE_RIGHT, c, &priv->stream);
 	slcd_encode(SLCDCODE_DOWN, r, &priv->stream);
+
+	priv->curpos_n++;
+	priv->curpos_steps += r + c;
+	priv->hw.row = r;
+	priv->hw.col = c;
+	priv->hw_cursor = 1;
+}
+
+static void slcd_right(struct ctrl_slcd *priv, uint8_t n)
+{
+	slcd_op(priv, SLCD_OP_RIGHT);
+	slcd_encode(SLCDCODE_RIGHT, n, &priv->stream);
+	priv->right_steps += n;
+	priv->hw.col += n;
+}
+
+/* Write the display char ch at the cursor */
+static void slcd_putc(struct ctrl_slcd *priv, uint8_t ch)
+{
+	slcd_op(priv, SLCD_OP_TEXT);
+	slcd_put(ch, &priv->stream);
+	priv->hw.cells[priv->hw.row][priv->hw.col] = ch;
+	/* On 20x4 display, after writing to the last column the row value
+	 * returned by the controller is not the next line but the current
+	 * +2: never rely on where the cursor goes. */
+	if (++priv->hw.col == SLCD_NCOLUMNS(priv))
+		priv->hw_cursor = 0;
+}
+
+static void slcd_clear(struct ctrl_slcd *priv)
+{
+	slcd_op(priv, SLCD_OP_CLEAR);
+	slcd_encode(SLCDCODE_CLEAR, 0, &priv->stream);
+	screen_clear(&priv->hw);
+	priv->hw_cursor = 1;
+}
+
+static void slcd_create_char(struct ctrl_slcd *priv, uint8_t idx,
+			     const uint8_t *bmp)
+{
+	struct slcd_createchar_s custom_char;
+
+	cbk_slcd_flush(&priv->stream);
+	custom_char.idx = idx;
+	memcpy(custom_char.bmp, bmp, 8);
+	if (!priv->writer) {
+		if (ioctl(priv->fd, SLCDIOC_CREATECHAR,
+			  (unsigned long)&custom_char) < 0)
+			slcd_fault(priv, "custom char failed");
+	} else if (!priv->resync &&
+		   /* Ordered with the writes around it */
+		   writer_submit_ioctl(priv->writer, SLCDIOC_CREATECHAR,
+				       &custom_char, sizeof(custom_char),
+				       SLCD_OP_CGRAM) < 0) {
+		priv->resync = 1;
+	}
+	memcpy(priv->hw.glyphs[idx], bmp, 8);
+	priv->hw.glyph_mask |= 1 << idx;
+}
+
+/* Cheapest way to move the cursor from row, col (if known) to r, c */
+static int slcd_plan_move(const struct ctrl_slcd *priv, int known,
+			  uint8_t row, uint8_t col, uint8_t r, uint8_t c,
+			  uint32_t *cost)
+{
+	const struct slcd_cost *k = &priv->cost;
+	uint32_t right, rewrite;
+	int n;
+
+	/* Positioning and RIGHT both break the text in one more write() */
+	*cost = k->curpos_ns + k->curpos_step_ns * (r + c) + k->write_ns;
+	if (!known || row != r || col > c)
+		return SLCD_MOVE_CURPOS;
+	n = c - col;
+	if (!n) {
+		*cost = 0;
+		return SLCD_MOVE_NONE;
+	}
+	/* The chars in between are already right, they can be written again */
+	rewrite = k->byte_ns * n;
+	right = 2 * k->write_ns + k->right_ns * n;
+	if (rewrite <= right && rewrite <= *cost) {
+		*cost = rewrite;
+		return SLCD_MOVE_REWRITE;
+	}
+	if (right <= *cost) {
+		*cost = right;
+		return SLCD_MOVE_RIGHT;
+	}
+	return SLCD_MOVE_CURPOS;
+}
+
+/* Estimate of bringing the display from cells (blank if NULL) to want,
+ * the cursor starting at row, col if known. */
+static uint32_t slcd_cost_cells(const struct ctrl_slcd *priv,
+				const uint8_t (*cells)[LCD_MAX_NCOLUMNS],
+				int known, uint8_t row, uint8_t col)
+{
+	uint32_t total = 0, cost;
+	int r, c;
+
+	for (r = 0; r < SLCD_NROWS(priv); r++) {
+		for (c = 0; c < SLCD_NCOLUMNS(priv); c++) {
+			if (priv->want[r][c] == (cells ? cells[r][c] : ' '))
+				continue;
+			slcd_plan_move(priv, known, row, col, r, c, &cost);
+			total += cost + priv->cost.byte_ns;
+			row = r;
+			col = c + 1;
+			known = col < SLCD_NCOLUMNS(priv);
+		}
+	}
+	return total;
+}
+
+/* Write the cells of want that differ from hw */
+static void slcd_render_cells(struct ctrl_slcd *priv)
+{
+	struct screen *hw = &priv->hw;
+	const uint8_t *line;
+	uint32_t cost;
+	int r, c, x;
+
+	for (r = 0; r < SLCD_NROWS(priv); r++) {
+		line = priv->want[r];
+		if (!memcmp(line, hw->cells[r], SLCD_NCOLUMNS(priv)))
+			continue;
+		for (c = 0; c < SLCD_NCOLUMNS(priv); c++) {
+			if (line[c] == hw->cells[r][c])
+				continue;
+			switch (slcd_plan_move(priv, priv->hw_cursor, hw->row,
+					       hw->col, r, c, &cost)) {
+			case SLCD_MOVE_REWRITE:
+				for (x = hw->col; x < c; x++)
+					slcd_putc(priv, line[x]);
+				break;
+			case SLCD_MOVE_RIGHT:
+				slcd_right(priv, c - hw->col);
+				break;
+			case SLCD_MOVE_CURPOS:
+				slcd_set_curpos(priv, r, c);
+				break;
+			default:
+				break;
+			}
+			slcd_putc(priv, line[c]);
+		}
+	}
+}
+
+/* Bring the display to what scr says. The cursor is not shown, it is left
+ * wherever the last write puts it. */
+static void slcd_render(struct ctrl_slcd *priv)
+{
+	const struct screen *scr = &priv->scr;
+	const uint8_t *bmp;
+	uint32_t diff, redraw;
+	int i;
+
+	if (!priv->hw_valid) {
+		priv->hw.glyph_mask = 0;
+		slcd_clear(priv);
+		priv->hw_valid = 1;
+	}
+
+	for (i = 0; i < SCREEN_NGLYPHS; i++) {
+		if (scr->glyph_mask & (1 << i)) {
+			/* The client wins over the charset */
+			if (priv->cs.glyph_mask & (1 << i))
+				charset_release(&priv->cs, i);
+			bmp = scr->glyphs[i];
+		} else if (priv->cs.glyph_mask & (1 << i)) {
+			bmp = priv->cs.glyphs[i];
+		} else {
+			continue;
+		}
+		if (!(priv->hw.glyph_mask & (1 << i)) ||
+		    memcmp(priv->hw.glyphs[i], bmp, 8))
+			slcd_create_char(priv, i, bmp);
+	}
+
+	/* After the custom chars: a released slot changes the mapping, the
+	 * cells showing it are rewritten */
+	for (i = 0; i < SLCD_NROWS(priv); i++)
+		charset_map(&priv->cs, priv->want[i], scr->cells[i],
+			    SLCD_NCOLUMNS(priv));
+
+	diff = slcd_cost_cells(priv, priv->hw.cells, priv->hw_cursor,
+			       priv->hw.row, priv->hw.col);
+	redraw = priv->cost.clear_ns + slcd_cost_cells(priv, NULL, 1, 0, 0);
+	if (redraw < diff)
+		slcd_clear(priv);
+	slcd_render_cells(priv);
+	cbk_slcd_flush(&priv->stream);
+}
+
+static uint32_t slcd_cost_ns(int64_t ns)
+{
+	/* Zero would make an operation look free */
+	return ns < 1 ? 1 : ns;
+}
+
+static uint32_t slcd_cost_ewma(uint32_t est, int64_t ns)
+{
+	return est + (slcd_cost_ns(ns) - (int64_t)est) / SLCD_COST_WEIGHT;
+}
+
+/* Many drivers don't implement SLCDIOC_CURPOS (-ENOTTY) */
+static void slcd_check_off(struct ctrl_slcd *priv, int err)
+{
+	if (priv->check_fails < SLCD_CHECK_FAILS)
+		info("slcd: cursor readback not available (%d), checks disabled\n",
+		     err);
+	priv->check_fails = SLCD_CHECK_FAILS;
+}
+
+/* Time each operation a few times, output goes straight to the display */
+static void slcd_calibrate(struct ctrl_slcd *priv)
+{
+	struct slcd_cost *k = &priv->cost;
+	struct slcd_curpos_s pos;
+	static const uint8_t blank[8];
+	uint8_t nrows = SLCD_NROWS(priv), ncolumns = SLCD_NCOLUMNS(priv);
+	uint64_t t, one = 0, row = 0, home = 0, far = 0, right = 0;
+	uint64_t clear = 0, cgram = 0, readback = 0;
+	int i, c;
+
+	for (i = 0; i < SLCD_CAL_ROUNDS; i++) {
+		/* One char and a whole row: fixed and per char cost */
+		slcd_set_curpos(priv, 0, 0);
+		cbk_slcd_flush(&priv->stream);
+		t = time_us();
+		slcd_putc(priv, '-');
+		cbk_slcd_flush(&priv->stream);
+		one += time_us() - t;
+
+		slcd_set_curpos(priv, 0, 0);
+		cbk_slcd_flush(&priv->stream);
+		t = time_us();
+		for (c = 0; c < ncolumns; c++)
+			slcd_putc(priv, '-');
+		cbk_slcd_flush(&priv->stream);
+		row += time_us() - t;
+
+		t = time_us();
+		slcd_set_curpos(priv, 0, 0);
+		cbk_slcd_flush(&priv->stream);
+		home += time_us() - t;
+
+		t = time_us();
+		slcd_set_curpos(priv, nrows - 1, ncolumns - 1);
+		cbk_slcd_flush(&priv->stream);
+		far += time_us() - t;
+
+		slcd_set_curpos(priv, 0, 0);
+		cbk_slcd_flush(&priv->stream);
+		t = time_us();
+		slcd_right(priv, ncolumns - 1);
+		cbk_slcd_flush(&priv->stream);
+		right += time_us() - t;
+
+		t = time_us();
+		slcd_clear(priv);
+		cbk_slcd_flush(&priv->stream);
+		clear += time_us() - t;
+
+		t = time_us();
+		slcd_create_char(priv, 0, blank);
+		cgram += time_us() - t;
+
+		t = time_us();
+		if (ioctl(priv->fd, SLCDIOC_CURPOS, (unsigned long)&pos) < 0)
+			slcd_check_off(priv, -errno);
+		readback += time_us() - t;
+	}
+
+#define SLCD_CAL_NS(x) ((int64_t)(x) * 1000 / SLCD_CAL_ROUNDS)
+	k->byte_ns = slcd_cost_ns(ncolumns > 1 ?
+			(SLCD_CAL_NS(row) - SLCD_CAL_NS(one)) / (ncolumns - 1) :
+			SLCD_CAL_NS(one));
+	k->write_ns = slcd_cost_ns(SLCD_CAL_NS(one) - k->byte_ns);
+	k->curpos_ns = slcd_cost_ns(SLCD_CAL_NS(home));
+	k->curpos_step_ns = slcd_cost_ns(nrows + ncolumns > 2 ?
+			(SLCD_CAL_NS(far) - SLCD_CAL_NS(home)) /
+			(nrows + ncolumns - 2) : 0);
+	k->right_ns = slcd_cost_ns(ncolumns > 1 ?
+			(SLCD_CAL_NS(right) - k->write_ns) / (ncolumns - 1) : 0);
+	k->clear_ns = slcd_cost_ns(SLCD_CAL_NS(clear));
+	k->cgram_ns = slcd_cost_ns(SLCD_CAL_NS(cgram));
+	k->curpos_read_ns = slcd_cost_ns(SLCD_CAL_NS(readback));
+#undef SLCD_CAL_NS
+
+	priv->curpos_n = 0;
+	priv->curpos_steps = 0;
+	priv->right_steps = 0;
+	/* The first render starts from scratch */
+	priv->hw_valid = 0;
+}
+
+/* Take in what the writer measured since the last call (discard it if
+ * !take). Only called with an empty queue: everything issued has been
+ * timed. */
+static void slcd_cost_update(struct ctrl_slcd *priv, int take)
+{
+	struct slcd_cost *k = &priv->cost;
+	struct writer_stats st;
+	struct writer_class d[WRITER_NCLASS];
+	int i;
+
+	writer_stats(priv->writer, &st);
+	for (i = 0; i < WRITER_NCLASS; i++) {
+		d[i].count = st.cls[i].count - priv->last[i].count;
+		d[i].bytes = st.cls[i].bytes - priv->last[i].bytes;
+		d[i].us = st.cls[i].us - priv->last[i].us;
+		priv->last[i] = st.cls[i];
+	}
+	if (!take)
+		goto exit_reset;
+
+	if (d[SLCD_OP_TEXT].bytes > d[SLCD_OP_TEXT].count) {
+		k->byte_ns = slcd_cost_ewma(k->byte_ns,
+			((int64_t)d[SLCD_OP_TEXT].us * 1000 -
+			 (int64_t)d[SLCD_OP_TEXT].count * k->write_ns) /
+			d[SLCD_OP_TEXT].bytes);
+		k->samples++;
+	}
+	if (priv->curpos_n && d[SLCD_OP_CURPOS].count) {
+		k->curpos_ns = slcd_cost_ewma(k->curpos_ns,
+			((int64_t)d[SLCD_OP_CURPOS].us * 1000 -
+			 (int64_t)priv->curpos_steps * k->curpos_step_ns) /
+			priv->curpos_n);
+		k->samples++;
+	}
+	if (priv->right_steps && d[SLCD_OP_RIGHT].count) {
+		k->right_ns = slcd_cost_ewma(k->right_ns,
+			((int64_t)d[SLCD_OP_RIGHT].us * 1000 -
+			 (int64_t)d[SLCD_OP_RIGHT].count * k->write_ns) /
+			priv->right_steps);
+		k->samples++;
+	}
+	if (d[SLCD_OP_CLEAR].count) {
+		k->clear_ns = slcd_cost_ewma(k->clear_ns,
+			(int64_t)d[SLCD_OP_CLEAR].us * 1000 /
+			d[SLCD_OP_CLEAR].count);
+		k->samples++;
+	}
+	if (d[SLCD_OP_CGRAM].count) {
+		k->cgram_ns = slcd_cost_ewma(k->cgram_ns,
+			(int64_t)d[SLCD_OP_CGRAM].us * 1000 /
+			d[SLCD_OP_CGRAM].count);
+		k->samples++;
+	}
+
+exit_reset:
+	priv->curpos_n = 0;
+	priv->curpos_steps = 0;
+	priv->right_steps = 0;
+}
+
+static void slcd_cost_log(struct ctrl_slcd *priv, const char *when)
+{
+	const struct slcd_cost *k = &priv->cost;
+
+	info("slcd cost %s (ns): write %u char %u curpos %u+%u/step\n", when,
+		k->write_ns, k->byte_ns, k->curpos_ns, k->curpos_step_ns);
+	info("\tright %u clear %u cgram %u curpos read %u, %u samples\n",
+		k->right_ns, k->clear_ns, k->cgram_ns, k->curpos_read_ns,
+		k->samples);
+}
+
+/* The slcd interface has no reset: reopening the device is what gets the
+ * driver to set the controller up again. Only called with an empty queue.
+ * Everything on the display is redrawn by the next render. */
+static int slcd_reopen(struct ctrl_slcd *priv)
+{
+	struct slcd_attributes_s attr;
+	int ret;
+
+	writer_deinit(priv->writer);
+	priv->writer = NULL;
+	if (priv->fd >= 0)
+		close(priv->fd);
+
+	priv->fd = open(priv->dev, O_RDWR);
+	if (priv->fd < 0)
+		return -errno;
+	ret = ioctl(priv->fd, SLCDIOC_GETATTRIBUTES, (unsigned long)&attr);
+	if (ret < 0) {
+		ret = -errno;
+		goto exit_open;
+	}
+	if (attr.nrows != priv->attr.nrows ||
+	    attr.ncolumns != priv->attr.ncolumns) {
+		ret = -ENODEV;
+		goto exit_open;
+	}
+
+	priv->writer = writer_init(priv->fd);
+	if (!priv->writer) {
+		ret = -ENOMEM;
+		goto exit_open;
+	}
+	/* The new writer times from zero */
+	memset(priv->last, 0, sizeof(priv->last));
+	priv->curpos_n = 0;
+	priv->curpos_steps = 0;
+	priv->right_steps = 0;
+
+	priv->resync = 0;
+	priv->hw_valid = 0;
+	priv->restore_cursor = 1;
+	priv->dirty = 1;
+	return 0;
+
+exit_open:
+	close(priv->fd);
+	priv->fd = -1;
+	return ret;
+}
+
+/* Ask the display where its cursor is and compare with where it must be,
+ * when the queue is empty and the last check is old enough. The cursor
+ * moves with every write: a display that reset or lost bytes is unlikely
+ * to have it right. Return the ms to the next check, -1 for none. */
+static int slcd_check(struct ctrl_slcd *priv, int busy)
+{
+	struct slcd_curpos_s pos;
+	uint32_t period, elapsed;
+	uint64_t min;
+
+	if (!SLCD_CHECK_MS || priv->check_fails >= SLCD_CHECK_FAILS)
+		return -1;
+	min = (uint64_t)priv->cost.curpos_read_ns * SLCD_CHECK_RATIO / 1000000;
+	period = min > SLCD_CHECK_MS ? min : SLCD_CHECK_MS;
+	elapsed = time_ms() - priv->check_ms;
+	if (elapsed < period)
+		return period - elapsed;
+	if (busy)
+		return SLCD_DEFER_MAX_MS;
+
+	if (!priv->hw_cursor) {
+		/* Somewhere known first, checked next round */
+		slcd_set_curpos(priv, SLCD_NROWS(priv) - 1, 0);
+		cbk_slcd_flush(&priv->stream);
+		return SLCD_DEFER_MAX_MS;
+	}
+
+	if (ioctl(priv->fd, SLCDIOC_CURPOS, (unsigned long)&pos) < 0) {
+		slcd_check_off(priv, -errno);
+		return -1;
+	}
+	if (pos.row == priv->hw.row && pos.column == priv->hw.col) {
+		priv->check_ms = time_ms();
+		priv->check_retry = 0;
+		priv->check_fails = 0;
+		return period;
+	}
+
+	dbg("slcd: cursor at %d,%d instead of %d,%d\n", pos.row, pos.column,
+	    priv->hw.row, priv->hw.col);
+	if (!priv->check_retry) {
+		/* Some controllers misreport it after some writes (see
+		 * slcd_putc()): put it there and read it again before
+		 * redrawing everything */
+		priv->check_retry = 1;
+		slcd_set_curpos(priv, priv->hw.row, priv->hw.col);
+		cbk_slcd_flush(&priv->stream);
+		return SLCD_DEFER_MAX_MS;
+	}
+	priv->check_ms = time_ms();
+	priv->check_retry = 0;
+	if (++priv->check_fails == SLCD_CHECK_FAILS) {
+		error("slcd: cursor readback unreliable, checks disabled\n");
+		return -1;
+	}
+	slcd_fault(priv, "cursor out of place");
+	return SLCD_RESYNC_MS;
 }
 
 #if 0
@@ -170,7 +788,7 @@ static void slcd_dump_table(struct ctrl_slcd *hndl)
 }
 #endif
 
-struct ctrl_slcd* ctrl_slcd_init(const char *dev)
+struct ctrl_slcd* ctrl_slcd_init(const char *dev, const struct charset *cs)
 {
 	int ret = 0;
 	struct ctrl_slcd *priv;
@@ -179,6 +797,11 @@ struct ctrl_slcd* ctrl_slcd_init(const char *dev)
 	if (priv == NULL)
 		return NULL;
 
+	if (strlen(dev) >= sizeof(priv->dev)) {
+		ret = -ENAMETOOLONG;
+		goto exit_alloc;
+	}
+	strcpy(priv->dev, dev);
 	priv->fd = open(dev, O_RDWR);
 	if (priv->fd < 0) {
 		ret = -errno;
@@ -189,7 +812,7 @@ struct ctrl_slcd* ctrl_slcd_init(const char *dev)
 	if (ret < 0) {
 		error("failed to get slcd attributes\n");
 		ret = -errno;
-		goto exit_alloc;
+		goto exit_open;
 	}
 
 	info("slcd attributes:\n");
@@ -198,11 +821,52 @@ struct ctrl_slcd* ctrl_slcd_init(const char *dev)
 	info("\tmax contrast: %d max brightness: %d\n",
 		priv->attr.maxcontrast, priv->attr.maxbrightness);
 
+	if (priv->attr.nrows != SLCD_NROWS(priv) ||
+	    priv->attr.ncolumns != SLCD_NCOLUMNS(priv)) {
+		error("slcd geometry %dx%d, expected %dx%d\n",
+			priv->attr.ncolumns, priv->attr.nrows,
+			SLCD_NCOLUMNS(priv), SLCD_NROWS(priv));
+		ret = -ENODEV;
+		goto exit_open;
+	}
+	if (priv->attr.nrows > LCD_MAX_NROWS ||
+	    priv->attr.ncolumns > LCD_MAX_NCOLUMNS) {
+		error("slcd geometry %dx%d not supported\n",
+			priv->attr.ncolumns, priv->attr.nrows);
+		ret = -ENODEV;
+		goto exit_open;
+	}
+
+	screen_init(&priv->scr, SLCD_NROWS(priv), SLCD_NCOLUMNS(priv));
+	screen_init(&priv->hw, SLCD_NROWS(priv), SLCD_NCOLUMNS(priv));
+
 	priv->stream.putc = cbk_slcd_putc;
 	priv->stream.flush = cbk_slcd_flush;
 
-	slcd_encode(SLCDCODE_CLEAR, 0, &priv->stream);
-	cbk_slcd_flush(&priv->stream);
+	if (cs)
+		priv->cs = *cs;
+	else
+		charset_init(&priv->cs, CHARSET_DEFAULT);
+
+	/* Before the writer: the display is timed directly */
+	slcd_calibrate(priv);
+	slcd_cost_log(priv, "calibrated");
+
+	priv->writer = writer_init(priv->fd);
+	if (!priv->writer) {
+		ret = -ENOMEM;
+		goto exit_open;
+	}
+
+#ifdef CONFIG_LCD_TRANSLATOR_SNAPSHOT
+	priv->snap = snapshot_init(SNAPSHOT_SHM_NAME);
+	if (!priv->snap)
+		error("screen snapshots not available\n");
+#endif
+
+	slcd_render(priv);
+	if (priv->snap)
+		snapshot_publish(priv->snap, &priv->scr);
 
 #if 0
 	slcd_dump_table(priv);
@@ -212,6 +876,8 @@ struct ctrl_slcd* ctrl_slcd_init(const char *dev)
 
 	return priv;
 
+exit_open:
+	close(priv->fd);
 exit_alloc:
 	free(priv);
 	error("init err: %d\n", ret);
@@ -222,7 +888,15 @@ int ctrl_slcd_deinit(struct ctrl_slcd *hndl)
 {
 	if (!hndl)
 		return -EINVAL;
-	close(hndl->fd);
+	if (hndl->writer)
+		cbk_slcd_flush(&hndl->stream);
+	writer_deinit(hndl->writer);
+	slcd_cost_log(hndl, "at exit");
+	if (hndl->faults)
+		info("slcd: %u display resets\n", hndl->faults);
+	snapshot_deinit(hndl->snap);
+	if (hndl->fd >= 0)
+		close(hndl->fd);
 	free(hndl);
 	return 0;
 }
@@ -230,35 +904,10 @@ int ctrl_slcd_deinit(struct ctrl_slcd *hndl)
 int ctrl_slcd_cmd(struct ctrl_slcd *hndl, const struct proto_cmd_data *cmd)
 {
 	struct ctrl_slcd *priv = hndl;
-	struct slcd_curpos_s attr_pos;
-	struct slcd_createchar_s custom_char;
 
+	/* Text, cursor, custom chars, bars and big numbers only change scr,
+	 * the display is brought to it by ctrl_slcd_flush(). */
 	switch(cmd->cmd) {
-	case PROTO_CMD_ASCII:
-		/* We need to save the position *before* writing because on 20x4
-		 * display, after writing to the last column the row value returned
-		 * by the controller is not the next line but the is the current +2.
-		 * To simplify the line wrap handling with different displays and
-		 * controllers we manually implement line wrap. */
-		ioctl(hndl->fd, SLCDIOC_CURPOS, (unsigned long)&attr_pos);
-#if 0
-		dbg("ascii: 0x%02x %c\n", cmd->data.ascii,
-				isprint(cmd->data.ascii) ? cmd->data.ascii : ' ');
-#endif
-		slcd_put(cmd->data.ascii, &priv->stream);
-		cbk_slcd_flush(&priv->stream);
-
-		/* Check if we wrote on the last column */
-		if (attr_pos.column == hndl->attr.ncolumns-1) {
-			if (attr_pos.row < hndl->attr.nrows-1)
-				attr_pos.row++;
-			else
-				attr_pos.row = 0;
-			/* This might be slow, evaluate to use SLCDCODE_DOWN when not
-			 * wrapping on the last line. */
-			slcd_set_curpos(priv, attr_pos.row, 0);
-		}
-		break;
 	case PROTO_CMD_GET_SN:
 	case PROTO_CMD_GET_FW_VER:
 	case PROTO_CMD_GET_DISPLAY_TYPE:
@@ -280,12 +929,6 @@ int ctrl_slcd_cmd(struct ctrl_slcd *hndl, const struct proto_cmd_data *cmd)
 		/* software implementation */
 		dbg("TODO: auto scroll off\n");
 		break;
-	case PROTO_CMD_SET_CURSOR_POS:
-		slcd_set_curpos(priv, cmd->data.pos.row-1, cmd->data.pos.col-1);
-		break;
-	case PROTO_CMD_SEND_CURSOR_HOME:
-		slcd_set_curpos(priv, 0, 0);
-		break;
 	case PROTO_CMD_UNDERLINE_CURSOR_ON:
 		dbg("TODO: underline cursor on\n");
 		/* TODO: check if supported by the display */
@@ -302,20 +945,6 @@ int ctrl_slcd_cmd(struct ctrl_slcd *hndl, const struct proto_cmd_data *cmd)
 		dbg("TODO: blink cursor off\n");
 		//slcd_encode(SLCDCODE_BLINKOFF, 0, &priv->stream);
 		break;
-	case PROTO_CMD_CURSOR_LEFT:
-		slcd_encode(SLCDCODE_LEFT, 1, &priv->stream);
-		break;
-	case PROTO_CMD_CURSOR_RIGHT:
-		slcd_encode(SLCDCODE_RIGHT, 1, &priv->stream);
-		break;
-	case PROTO_CMD_ADD_CUSTOM_CHAR:
-		custom_char.idx = cmd->data.custom_char.idx;
-		memcpy(custom_char.bmp, cmd->data.custom_char.bmp, 8);
-		ioctl(hndl->fd, SLCDIOC_CREATECHAR, &custom_char);
-		break;
-	case PROTO_CMD_CLR_DISPLAY:
-		slcd_encode(SLCDCODE_CLEAR, 0, &priv->stream);
-		break;
 	case PROTO_CMD_SET_CONTRAST: /* data */
 		info("contrast not supported\n");
 		break;
@@ -334,14 +963,119 @@ int ctrl_slcd_cmd(struct ctrl_slcd *hndl, const struct proto_cmd_data *cmd)
 	case PROTO_CMD_GPO_ON:
 		break;
 	default:
-		info("cmd %d not implemented\n", cmd->cmd);
 		break;
 	}
 
-	if (cmd->cmd != PROTO_CMD_ASCII) {
-		/* All cmds but ascii char shall be executed immediately. */
-		cbk_slcd_flush(&priv->stream);
+	if (screen_apply(&priv->scr, cmd)) {
+		priv->dirty = 1;
+		priv->unpublished = 1;
 	}
 
 	return 0;
 }
+
+static int slcd_flush(struct ctrl_slcd *hndl)
+{
+	struct ctrl_slcd *priv = hndl;
+	uint64_t ms;
+	int pending, ret;
+
+	if (priv->writer && writer_failed(priv->writer))
+		slcd_fault(priv, "output failed");
+	pending = priv->writer ? writer_pending(priv->writer) : 0;
+
+	if (priv->fault) {
+		/* Let the writer give up on what it has first */
+		if (pending)
+			return SLCD_RESYNC_MS;
+		ret = slcd_reopen(priv);
+		if (ret < 0) {
+			dbg("slcd: reopen failed: %d\n", ret);
+			return SLCD_RESYNC_MS;
+		}
+		priv->fault = 0;
+		info("slcd: display reopened, redraw\n");
+	} else if (priv->resync) {
+		/* Wait for the queue to drain, the redraw needs most of it */
+		if (pending)
+			return SLCD_RESYNC_MS;
+		/* What was dropped was never timed */
+		slcd_cost_update(priv, 0);
+		priv->resync = 0;
+		priv->hw_valid = 0;
+		priv->dirty = 1;
+		info("slcd: redraw\n");
+	} else if (!pending) {
+		slcd_cost_update(priv, 1);
+	}
+
+	if (!priv->dirty)
+		return slcd_check(priv, pending);
+	if (pending) {
+		/* Render when the display is done with what it has: the changes
+		 * meanwhile cost nothing and might undo each other. */
+		ms = (uint64_t)pending * priv->cost.byte_ns / 1000000 + 1;
+		return ms < SLCD_DEFER_MAX_MS ? ms : SLCD_DEFER_MAX_MS;
+	}
+
+	slcd_render(priv);
+	if (priv->restore_cursor && priv->scr.col < SLCD_NCOLUMNS(priv)) {
+		slcd_set_curpos(priv, priv->scr.row, priv->scr.col);
+		cbk_slcd_flush(&priv->stream);
+	}
+	priv->restore_cursor = 0;
+	priv->dirty = 0;
+	return priv->resync || priv->fault ? SLCD_RESYNC_MS : slcd_check(priv, 1);
+}
+
+int ctrl_slcd_flush(struct ctrl_slcd *hndl)
+{
+	int ret = slcd_flush(hndl);
+
+	/* Once per batch of commands, not on the input path */
+	if (hndl->unpublished && hndl->snap) {
+		snapshot_publish(hndl->snap, &hndl->scr);
+		hndl->unpublished = 0;
+	}
+	return ret;
+}
+
+void ctrl_slcd_geometry(struct ctrl_slcd *hndl, uint8_t *nrows, uint8_t *ncolumns)
+{
+	*nrows = SLCD_NROWS(hndl);
+	*ncolumns = SLCD_NCOLUMNS(hndl);
+}
+
+int ctrl_slcd_snapshot(struct ctrl_slcd *hndl, struct lcd_snapshot *snap)
+{
+	if (!hndl->snap)
+		return -ENODEV;
+	return snapshot_read(hndl->snap, snap);
+}
+
+static int slcd_op_cmd(void *hndl, const struct proto_cmd_data *cmd)
+{
+	return ctrl_slcd_cmd(hndl, cmd);
+}
+
+static int slcd_op_flush(void *hndl)
+{
+	return ctrl_slcd_flush(hndl);
+}
+
+static void slcd_op_geometry(void *hndl, uint8_t *nrows, uint8_t *ncolumns)
+{
+	ctrl_slcd_geometry(hndl, nrows, ncolumns);
+}
+
+static int slcd_op_deinit(void *hndl)
+{
+	return ctrl_slcd_deinit(hndl);
+}
+
+const struct ctrl_ops ctrl_slcd_ops = {
+	.cmd = slcd_op_cmd,
+	.flush = slcd_op_flush,
+	.geometry = slcd_op_geometry,
+	.deinit = slcd_op_deinit,
+};
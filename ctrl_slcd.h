@@ -17,10 +17,36 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef CTRL_SLCD_H
+#define CTRL_SLCD_H
+
+#include <stdint.h>
 #include "proto.h"
+#include "snapshot.h"
+#include "charset.h"
+#include "ctrl.h"
+
+#ifdef CONFIG_LCD_TRANSLATOR_SLCD_CHECK_MS
+#  define SLCD_CHECK_MS CONFIG_LCD_TRANSLATOR_SLCD_CHECK_MS
+#else
+#  define SLCD_CHECK_MS 1000
+#endif
 
 struct ctrl_slcd;
 
-struct ctrl_slcd* ctrl_slcd_init(const char *dev);
+extern const struct ctrl_ops ctrl_slcd_ops;
+
+/* cs is copied, NULL for CHARSET_DEFAULT */
+struct ctrl_slcd* ctrl_slcd_init(const char *dev, const struct charset *cs);
 int ctrl_slcd_deinit(struct ctrl_slcd *hndl);
+/* Only updates the model of the screen, see ctrl_slcd_flush() */
 int ctrl_slcd_cmd(struct ctrl_slcd *hndl, const struct proto_cmd_data *cmd);
+/* Queue what changed since the last call, when the writer is done with
+ * what it has. Return the ms after which it must be called again or -1.
+ */
+int ctrl_slcd_flush(struct ctrl_slcd *hndl);
+void ctrl_slcd_geometry(struct ctrl_slcd *hndl, uint8_t *nrows, uint8_t *ncolumns);
+/* Consistent copy of the screen content, never blocks the display */
+int ctrl_slcd_snapshot(struct ctrl_slcd *hndl, struct lcd_snapshot *snap);
+
+#endif /* CTRL_SLCD_H */
@@ -0,0 +1,304 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include "glyphs.h"
+#include "lcd_geometry.h"
+
+#define GLYPH_W 5
+#define GLYPH_H 8
+#define GLYPH_FULL 0x1f
+
+/* Big numbers are 3 columns wide and are drawn with 4 glyphs:
+ * F: full block, T: top bar, B: bottom bar, X: top and bottom bars.
+ * The design is for 2 rows, on 4 rows displays every row is split in two.
+ */
+enum big_num_glyph {
+	BIG_FULL,
+	BIG_TOP,
+	BIG_BOT,
+	BIG_TOPBOT,
+};
+
+static const char *big_num_font[10][2] = {
+	{ "FTF", "FBF" },
+	{ "TF ", "BFB" },
+	{ "XXF", "FBB" },
+	{ "XXF", "BBF" },
+	{ "FBF", "  F" },
+	{ "FXX", "BBF" },
+	{ "FXX", "FBF" },
+	{ "TTF", "  F" },
+	{ "FXF", "FBF" },
+	{ "FXF", "BBF" },
+};
+
+int glyph_is_cmd(enum proto_cmds cmd)
+{
+	switch (cmd) {
+	case PROTO_CMD_INIT_HBAR:
+	case PROTO_CMD_INIT_VBAR_WIDE:
+	case PROTO_CMD_INIT_VBAR_NARROW:
+	case PROTO_CMD_PLACE_HBAR:
+	case PROTO_CMD_PLACE_VBAR:
+	case PROTO_CMD_INIT_BIG_NUM:
+	case PROTO_CMD_PLACE_BIG_NUM:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void glyph_bitmap(enum glyph_set set, uint8_t idx, uint8_t *bmp)
+{
+	int r;
+
+	memset(bmp, 0, GLYPH_H);
+	switch (set) {
+	case GLYPH_SET_HBAR_RIGHT:
+		/* idx + 1 columns filled from the left */
+		for (r = 0; r < GLYPH_H; r++)
+			bmp[r] = (GLYPH_FULL << (GLYPH_W - idx - 1)) & GLYPH_FULL;
+		break;
+	case GLYPH_SET_HBAR_LEFT:
+		/* idx + 1 columns filled from the right */
+		for (r = 0; r < GLYPH_H; r++)
+			bmp[r] = GLYPH_FULL >> (GLYPH_W - idx - 1);
+		break;
+	case GLYPH_SET_VBAR_WIDE:
+	case GLYPH_SET_VBAR_NARROW:
+		/* idx + 1 rows filled from the bottom */
+		for (r = GLYPH_H - idx - 1; r < GLYPH_H; r++)
+			bmp[r] = set == GLYPH_SET_VBAR_WIDE ? GLYPH_FULL : 0x0c;
+		break;
+	case GLYPH_SET_BIG_NUM:
+		for (r = 0; r < GLYPH_H; r++) {
+			if (idx == BIG_FULL ||
+			    ((idx == BIG_TOP || idx == BIG_TOPBOT) && r < 3) ||
+			    ((idx == BIG_BOT || idx == BIG_TOPBOT) && r >= GLYPH_H - 3))
+				bmp[r] = GLYPH_FULL;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static int glyph_nchars(enum glyph_set set)
+{
+	switch (set) {
+	case GLYPH_SET_HBAR_RIGHT:
+	case GLYPH_SET_HBAR_LEFT:
+		return GLYPH_W;
+	case GLYPH_SET_VBAR_WIDE:
+	case GLYPH_SET_VBAR_NARROW:
+		return GLYPH_H;
+	case GLYPH_SET_BIG_NUM:
+		return BIG_TOPBOT + 1;
+	default:
+		return 0;
+	}
+}
+
+static int glyph_load(struct glyph_state *st, enum glyph_set set,
+		      glyph_emit_t emit, void *ctx)
+{
+	struct proto_cmd_data d;
+	int i, n = glyph_nchars(set);
+
+	if (st->set == set)
+		return 0;
+
+	memset(&d, 0, sizeof(d));
+	d.cmd = PROTO_CMD_ADD_CUSTOM_CHAR;
+	for (i = 0; i < n; i++) {
+		d.data.custom_char.idx = i;
+		glyph_bitmap(set, i, d.data.custom_char.bmp);
+		emit(ctx, &d);
+	}
+	/* Set it last: emit might have reset it while uploading */
+	st->set = set;
+	return n;
+}
+
+/* r and c are zero based */
+static int glyph_put(uint8_t r, uint8_t c, const uint8_t *s, int len,
+		     glyph_emit_t emit, void *ctx)
+{
+	struct proto_cmd_data d;
+	int i;
+
+	memset(&d, 0, sizeof(d));
+	d.cmd = PROTO_CMD_SET_CURSOR_POS;
+	d.data.pos.row = r + 1;
+	d.data.pos.col = c + 1;
+	emit(ctx, &d);
+
+	d.cmd = PROTO_CMD_ASCII;
+	for (i = 0; i < len; i++) {
+		d.data.ascii = s[i];
+		emit(ctx, &d);
+	}
+	return len + 1;
+}
+
+static int glyph_hbar(struct glyph_state *st, const struct proto_bar *bar,
+		      uint8_t nrows, uint8_t ncolumns, glyph_emit_t emit, void *ctx)
+{
+	uint8_t cells[LCD_MAX_NCOLUMNS];
+	int left = bar->dir != 0;
+	int len = bar->len;
+	int n, span, ret;
+
+	if (bar->row < 1 || bar->row > nrows || bar->col < 1 || bar->col > ncolumns)
+		return -EINVAL;
+
+	ret = glyph_load(st, left ? GLYPH_SET_HBAR_LEFT : GLYPH_SET_HBAR_RIGHT,
+			 emit, ctx);
+
+	/* The bar owns the row from bar->col to the edge it grows to: what a
+	 * longer bar left there is blanked. Cells are in drawing order. */
+	span = left ? bar->col : ncolumns - bar->col + 1;
+	for (n = 0; n < span; n++) {
+		cells[n] = ' ';
+		if (len > 0)
+			cells[n] = (len >= GLYPH_W ? GLYPH_W : len) - 1;
+		len -= GLYPH_W;
+	}
+
+	if (left) {
+		uint8_t rev[LCD_MAX_NCOLUMNS];
+
+		for (n = 0; n < span; n++)
+			rev[n] = cells[span - n - 1];
+		return ret + glyph_put(bar->row - 1, 0, rev, span, emit, ctx);
+	}
+	return ret + glyph_put(bar->row - 1, bar->col - 1, cells, span, emit, ctx);
+}
+
+static int glyph_vbar(struct glyph_state *st, const struct proto_bar *bar,
+		      uint8_t nrows, uint8_t ncolumns, glyph_emit_t emit, void *ctx)
+{
+	int len = bar->len;
+	int r, ret = 0;
+
+	if (bar->col < 1 || bar->col > ncolumns)
+		return -EINVAL;
+
+	if (st->set != GLYPH_SET_VBAR_WIDE && st->set != GLYPH_SET_VBAR_NARROW)
+		ret = glyph_load(st, GLYPH_SET_VBAR_WIDE, emit, ctx);
+
+	/* The bar owns the whole column, from the bottom row up */
+	for (r = nrows - 1; r >= 0; r--) {
+		uint8_t c = ' ';
+
+		if (len > 0)
+			c = (len >= GLYPH_H ? GLYPH_H : len) - 1;
+		len -= GLYPH_H;
+		ret += glyph_put(r, bar->col - 1, &c, 1, emit, ctx);
+	}
+	return ret;
+}
+
+static uint8_t big_num_code(char g)
+{
+	switch (g) {
+	case 'F':
+		return BIG_FULL;
+	case 'T':
+		return BIG_TOP;
+	case 'B':
+		return BIG_BOT;
+	case 'X':
+		return BIG_TOPBOT;
+	default:
+		return ' ';
+	}
+}
+
+/* Split a 2 rows glyph in the top or bottom half of a 4 rows one */
+static char big_num_split(char g, int bottom)
+{
+	switch (g) {
+	case 'F':
+		return 'F';
+	case 'T':
+		return bottom ? ' ' : 'T';
+	case 'B':
+		return bottom ? 'B' : ' ';
+	case 'X':
+		return bottom ? 'B' : 'T';
+	default:
+		return ' ';
+	}
+}
+
+static int glyph_big_num(struct glyph_state *st, const struct proto_big_num *num,
+			 uint8_t nrows, uint8_t ncolumns, glyph_emit_t emit,
+			 void *ctx)
+{
+	int tall = nrows >= 4;
+	int r, i, ret, len;
+
+	if (num->digit > 9 || num->col < 1 || num->col > ncolumns || nrows < 2)
+		return -EINVAL;
+
+	ret = glyph_load(st, GLYPH_SET_BIG_NUM, emit, ctx);
+
+	len = ncolumns - num->col + 1;
+	if (len > 3)
+		len = 3;
+	for (r = 0; r < (tall ? 4 : 2); r++) {
+		const char *design = big_num_font[num->digit][tall ? r / 2 : r];
+		uint8_t row[3];
+
+		for (i = 0; i < 3; i++) {
+			char g = tall ? big_num_split(design[i], r & 1) : design[i];
+
+			row[i] = big_num_code(g);
+		}
+		ret += glyph_put(r, num->col - 1, row, len, emit, ctx);
+	}
+	return ret;
+}
+
+int glyph_render(struct glyph_state *st, const struct proto_cmd_data *cmd,
+		 uint8_t nrows, uint8_t ncolumns, glyph_emit_t emit, void *ctx)
+{
+	switch (cmd->cmd) {
+	case PROTO_CMD_INIT_HBAR:
+		return glyph_load(st, GLYPH_SET_HBAR_RIGHT, emit, ctx);
+	case PROTO_CMD_INIT_VBAR_WIDE:
+		return glyph_load(st, GLYPH_SET_VBAR_WIDE, emit, ctx);
+	case PROTO_CMD_INIT_VBAR_NARROW:
+		return glyph_load(st, GLYPH_SET_VBAR_NARROW, emit, ctx);
+	case PROTO_CMD_INIT_BIG_NUM:
+		return glyph_load(st, GLYPH_SET_BIG_NUM, emit, ctx);
+	case PROTO_CMD_PLACE_HBAR:
+		return glyph_hbar(st, &cmd->data.bar, nrows, ncolumns, emit, ctx);
+	case PROTO_CMD_PLACE_VBAR:
+		return glyph_vbar(st, &cmd->data.bar, nrows, ncolumns, emit, ctx);
+	case PROTO_CMD_PLACE_BIG_NUM:
+		return glyph_big_num(st, &cmd->data.big_num, nrows, ncolumns,
+				     emit, ctx);
+	default:
+		return -EINVAL;
+	}
+}
@@ -0,0 +1,57 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <stdint.h>
+#include "proto.h"
+
+/* Built-in custom char sets used to draw bars and big numbers. */
+enum glyph_set {
+	GLYPH_SET_NONE,
+	GLYPH_SET_HBAR_RIGHT,
+	GLYPH_SET_HBAR_LEFT,
+	GLYPH_SET_VBAR_WIDE,
+	GLYPH_SET_VBAR_NARROW,
+	GLYPH_SET_BIG_NUM,
+};
+
+/* Keep track of the set loaded in the display custom chars. Must be reset
+ * to GLYPH_SET_NONE whenever a custom char is changed by someone else.
+ */
+struct glyph_state {
+	enum glyph_set set;
+};
+
+typedef int (*glyph_emit_t)(void *ctx, const struct proto_cmd_data *cmd);
+
+/* Return 1 if cmd is a bar / big number command */
+int glyph_is_cmd(enum proto_cmds cmd);
+
+/* Expand a bar / big number command into plain commands (custom chars,
+ * cursor position and ascii) passed one by one to emit.
+ * The custom chars are uploaded only when the needed set is not loaded.
+ *
+ * Return the number of emitted commands or -EINVAL.
+ */
+int glyph_render(struct glyph_state *st, const struct proto_cmd_data *cmd,
+		 uint8_t nrows, uint8_t ncolumns, glyph_emit_t emit, void *ctx);
+
+#endif /* GLYPHS_H */
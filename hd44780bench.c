@@ -0,0 +1,161 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Count the I2C traffic of the direct HD44780 backend on the mock
+ * adapter, for an lcdproc like stream of screens.
+ *
+ * hd44780bench [-g <columns>x<rows>] [-n frames] [-t]
+ *
+ * -t: every row is a ticker scrolling left by one column each frame.
+ *
+ * The slcd driver path does one I2C transaction per expander byte, the
+ * "unpacked" figure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ctrl_hd44780.h"
+#include "proto.h"
+#include "screen.h"
+#include "utils.h"
+
+#define BENCH_BUF_SIZE 256 /* Must be power of 2 */
+
+static int bench_frame(char *buf, int frame, int nrows, int ncolumns)
+{
+	int len = 0, r, c;
+
+	if (!(frame % 50)) {
+		buf[len++] = 0xfe;
+		buf[len++] = 0x58; /* clear */
+	}
+	for (r = 0; r < nrows; r++) {
+		char line[64];
+
+		buf[len++] = 0xfe;
+		buf[len++] = 0x47; /* cursor position */
+		buf[len++] = 1;
+		buf[len++] = r + 1;
+		memset(line, ' ', sizeof(line));
+		c = snprintf(line, sizeof(line), "row %d frame %d load %d%%",
+			     r, frame, (frame * 7 + r * 13) % 100);
+		line[c] = ' ';
+		memcpy(&buf[len], line, ncolumns);
+		len += ncolumns;
+	}
+	return len;
+}
+
+static int bench_ticker(char *buf, int frame, int nrows, int ncolumns)
+{
+	static const char *msg[] = {
+		"*** lcd_translator ticker, one column per frame *** ",
+		"load 0.42 0.37 0.31  uptime 12 days  mem 61% free ",
+	};
+	int len = 0, r, c, n;
+
+	for (r = 0; r < nrows; r++) {
+		n = strlen(msg[r % 2]);
+		buf[len++] = 0xfe;
+		buf[len++] = 0x47; /* cursor position */
+		buf[len++] = 1;
+		buf[len++] = r + 1;
+		for (c = 0; c < ncolumns; c++)
+			buf[len++] = msg[r % 2][(frame + c) % n];
+	}
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *geometry = "20x4";
+	struct ctrl_hd44780 *hd;
+	struct hd44780_stats st;
+	struct mtxorb_hndl *mtxorb;
+	struct proto_cmd_ops ops;
+	struct proto_cmd_data d;
+	struct screen model;
+	char spec[32], in[BENCH_BUF_SIZE];
+	struct circ_buf cb = { .buf = in };
+	uint8_t nrows, ncolumns;
+	int frames = 1000, ticker = 0, opt, i, r, c, len, bad = 0;
+	uint32_t start;
+
+	while ((opt = getopt(argc, argv, "g:n:t")) != -1) {
+		switch (opt) {
+		case 'g':
+			geometry = optarg;
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 't':
+			ticker = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-g <columns>x<rows>] [-n frames] [-t]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	snprintf(spec, sizeof(spec), "%s:%s", HD44780_MOCK_DEV, geometry);
+	hd = ctrl_hd44780_init(spec, NULL);
+	if (!hd || proto_mtxorb_init(&mtxorb, &ops) < 0)
+		return 1;
+	ctrl_hd44780_geometry(hd, &nrows, &ncolumns);
+	screen_init(&model, nrows, ncolumns);
+
+	start = time_us();
+	for (i = 0; i < frames; i++) {
+		if (ticker)
+			len = bench_ticker(in, i, nrows, ncolumns);
+		else
+			len = bench_frame(in, i, nrows, ncolumns);
+		cb.head = len;
+		cb.tail = 0;
+		while (ops.parse_cmd_buffered(mtxorb, &cb, BENCH_BUF_SIZE, &d) == 1) {
+			ctrl_hd44780_cmd(hd, &d);
+			screen_apply(&model, &d);
+		}
+		ctrl_hd44780_flush(hd);
+	}
+	start = time_us() - start;
+
+	for (r = 0; r < nrows; r++) {
+		for (c = 0; c < ncolumns; c++)
+			bad += ctrl_hd44780_mock_cell(hd, r, c) != model.cells[r][c];
+	}
+
+	ctrl_hd44780_stats(hd, &st);
+	printf("%d frames %ux%u, %u us cpu\n", frames, ncolumns, nrows, start);
+	printf("hd44780: %u data %u instructions %u shifts\n", st.data,
+	       st.instrs, st.shifts);
+	printf("i2c packed: %u transactions %u bytes (%.1f per frame)\n",
+	       st.xfers, st.bytes, (double)st.xfers / frames);
+	printf("i2c unpacked: %u transactions (%.0fx)\n", st.bytes,
+	       (double)st.bytes / st.xfers);
+	printf("display content: %s\n", bad ? "MISMATCH" : "ok");
+
+	proto_mtxorb_deinit(mtxorb);
+	ctrl_hd44780_deinit(hd);
+	return bad ? 2 : 0;
+}
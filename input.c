@@ -0,0 +1,155 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "utils.h"
+
+#if (INPUT_BUF_SIZE & (INPUT_BUF_SIZE - 1))
+#  error "INPUT_BUF_SIZE must be a power of 2"
+#endif
+
+void input_init(struct input *in, void *proto, struct proto_cmd_ops *ops,
+		struct cmdq *q, struct ctrl *lcd)
+{
+	in->proto = proto;
+	in->ops = ops;
+	in->q = q;
+	in->lcd = lcd;
+	in->parsed = NULL;
+	in->ctx = NULL;
+	in->rx.buf = in->rx_buf;
+	in->rx.head = 0;
+	in->rx.tail = 0;
+	in->batch_ms = 0;
+	in->overloads = 0;
+}
+
+int input_read(struct input *in, int fd)
+{
+	struct circ_buf *rx = &in->rx;
+	int ret;
+
+	ret = read(fd, &rx->buf[rx->head],
+		   CIRC_SPACE_TO_END(rx->head, rx->tail, INPUT_BUF_SIZE));
+	if (ret < 0)
+		return -errno;
+	rx->head = (rx->head + ret) & (INPUT_BUF_SIZE - 1);
+	return ret;
+}
+
+void input_apply(struct input *in)
+{
+	struct proto_cmd_data cdata;
+
+	while (cmdq_pop(in->q, &cdata))
+		in->lcd->ops->cmd(in->lcd->hndl, &cdata);
+}
+
+int input_flush(struct input *in)
+{
+	input_apply(in);
+	return in->lcd->ops->flush(in->lcd->hndl);
+}
+
+static void input_parse(struct input *in)
+{
+	struct proto_cmd_data cdata;
+	int ret;
+
+	/* Text comes out in runs, not one char at time */
+	while ((ret = in->ops->parse_cmd_buffered(in->proto, &in->rx,
+						  INPUT_BUF_SIZE, &cdata))) {
+		if (ret != 1) {
+			error("parse_fail\n");
+			continue;
+		}
+		/* Commands transcript, text is on the display */
+		if (cdata.cmd == PROTO_CMD_SET_CURSOR_POS)
+			dbg("CMD: %s[r: %02d c: %02d]\n", proto_cmds_str[cdata.cmd],
+			    cdata.data.pos.row, cdata.data.pos.col);
+		else if (cdata.cmd != PROTO_CMD_TEXT && cdata.cmd != PROTO_CMD_ASCII)
+			dbg("CMD: %s\n", proto_cmds_str[cdata.cmd]);
+		if (in->parsed)
+			in->parsed(in->ctx, &cdata);
+		/* Full of what cannot be shed, it goes to the model first */
+		if (cmdq_push(in->q, &cdata) == -EAGAIN) {
+			input_apply(in);
+			cmdq_push(in->q, &cdata);
+		}
+	}
+}
+
+/* What the protocol answers to the commands parsed so far */
+static void input_reply(struct input *in, int fd)
+{
+	uint8_t buf[64];
+	int n;
+
+	if (!in->ops->reply)
+		return;
+	while ((n = in->ops->reply(in->proto, buf, sizeof(buf))) > 0) {
+		if (write(fd, buf, n) < 0)
+			break;
+	}
+}
+
+/* More input is already waiting */
+static int input_pending(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) > 0;
+}
+
+int input_process(struct input *in, int fd, int *timeout)
+{
+	int pending;
+
+	if (!cmdq_depth(in->q))
+		in->batch_ms = time_ms();
+	input_parse(in);
+	input_reply(in, fd);
+	/* Take what is already waiting before rendering: commands it
+	 * supersedes are shed instead of shown late */
+	pending = input_pending(fd);
+	if (pending && time_ms() - in->batch_ms < CMDQ_BATCH_MS)
+		return 0;
+	cmdq_lag(in->q, pending);
+	*timeout = input_flush(in);
+	input_report(in);
+	return 1;
+}
+
+void input_report(struct input *in)
+{
+	struct cmdq_stats st;
+
+	cmdq_stats(in->q, &st);
+	if (st.overloads == in->overloads)
+		return;
+	in->overloads = st.overloads;
+	info("input overload %u: %u commands, %u text and %u cursor moves "
+	     "shed, %u full, max depth %u\n", st.overloads, st.pushed,
+	     st.shed_text, st.shed_cursor, st.full, st.max_depth);
+	dbg("\tshedding started %u times\n", st.sheds);
+}
@@ -0,0 +1,72 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include "proto.h"
+#include "circ_buf.h"
+#include "cmdq.h"
+#include "ctrl.h"
+
+#define INPUT_BUF_SIZE (1 << 10) /* Must be power of 2 */
+
+typedef void (*input_parsed_t)(void *ctx, const struct proto_cmd_data *cmd);
+
+/* The server side of the translator: what is read from a server port is
+ * parsed, queued in q and applied to the display. */
+struct input {
+	void *proto;
+	struct proto_cmd_ops *ops;
+	struct cmdq *q;
+	struct ctrl *lcd;
+	/* Optional, sees each command parsed */
+	input_parsed_t parsed;
+	void *ctx;
+	struct circ_buf rx;
+	char rx_buf[INPUT_BUF_SIZE];
+	/* When the batch being parsed started */
+	uint32_t batch_ms;
+	/* Overloads already reported */
+	uint32_t overloads;
+};
+
+void input_init(struct input *in, void *proto, struct proto_cmd_ops *ops,
+		struct cmdq *q, struct ctrl *lcd);
+/* Read what fd holds. Return the bytes read, 0 at eof or a negative
+ * errno. */
+int input_read(struct input *in, int fd);
+/* Parse what was read and send the replies on fd. Commands wait in q,
+ * where the text and cursor moves that later input supersedes are shed:
+ * the display is only updated once the input already waiting on fd is
+ * parsed, or the batch is CMDQ_BATCH_MS old.
+ * Return 1 if the display was flushed, *timeout is then what flush()
+ * returned, 0 otherwise. */
+int input_process(struct input *in, int fd, int *timeout);
+/* Queued commands to the display model */
+void input_apply(struct input *in);
+/* Apply and flush. Return the ms after which it must be called again or
+ * -1. */
+int input_flush(struct input *in);
+/* Log the queue stats if the input got ahead of the display since the
+ * last report */
+void input_report(struct input *in);
+
+#endif /* INPUT_H */
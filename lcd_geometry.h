@@ -0,0 +1,53 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LCD_GEOMETRY_H
+#define LCD_GEOMETRY_H
+
+#ifdef __NuttX__
+#include <nuttx/config.h>
+#endif
+
+/* Display geometry.
+ *
+ * When CONFIG_LCD_TRANSLATOR_FIXED_GEOMETRY is selected the panel size is
+ * known at build time: buffers are sized for that panel only and every
+ * rows/columns expression becomes a constant.
+ * Otherwise buffers have room for 4 rows of 40 columns (160 cells), so
+ * that both of the biggest HD44780 layouts fit, 4x20 and 2x40, and the
+ * real size is read from the driver. One controller drives at most 80
+ * chars (LCD_HD44780_CELLS).
+ */
+#ifdef CONFIG_LCD_TRANSLATOR_FIXED_GEOMETRY
+#  define LCD_FIXED_GEOMETRY
+#  define LCD_MAX_NROWS CONFIG_LCD_TRANSLATOR_NROWS
+#  define LCD_MAX_NCOLUMNS CONFIG_LCD_TRANSLATOR_NCOLUMNS
+#else
+#  define LCD_MAX_NROWS 4
+#  define LCD_MAX_NCOLUMNS 40
+#endif
+
+#define LCD_MAX_CELLS (LCD_MAX_NROWS * LCD_MAX_NCOLUMNS)
+#define LCD_HD44780_CELLS 80
+
+#if defined(LCD_FIXED_GEOMETRY) && LCD_MAX_CELLS > LCD_HD44780_CELLS
+#  error "Display geometry bigger than a single HD44780 controller (80 chars)"
+#endif
+
+#endif /* LCD_GEOMETRY_H */
@@ -0,0 +1,502 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Synthetic mtxorb client, driving the display as lcdproc would, to soak
+ * test the translator at and beyond line rate.
+ *
+ * lcdgen [-o <output>] [-b <baud>] [-r <frames/s>] [-n frames] [-t seconds]
+ *        [-g <columns>x<rows>] [-m <kind>:<weight>[,...]] [-s seed]
+ *
+ * -o: "-" for stdout (default), "pty" for a new pty whose name is printed
+ *     on stderr, a tty or a file
+ * -b: line speed. A tty is set to it (default 19200), anything else is
+ *     paced as the line would be, 0 (default) for as fast as it takes it
+ * -r: frames per second, 0 (default) for back to back frames
+ * -n, -t: stop after that many frames (default 1000) or seconds
+ * -m: how often each kind of frame is picked (default
+ *     redraw:4,bars:2,scroll:2,cursor:1,garbage:0)
+ *     redraw  every row rewritten, clearing now and then
+ *     bars    bar graphs, placed by the translator or made of custom chars
+ *     scroll  tickers and a log scrolling up
+ *     cursor  storm of cursor moves writing single chars
+ *     garbage random bytes, then the padding a client needs to resync
+ *
+ * Frames are built as proto_cmd_data and encoded with the mtxorb opcode
+ * table of the parser (proto_mtxorb_encode()).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "lcd_geometry.h"
+#include "proto.h"
+#include "utils.h"
+
+#define GEN_BUF_SIZE 2048
+/* Start bit, 8 data bits, stop bit */
+#define GEN_BITS_PER_BYTE 10
+/* Completes any partial command: longest argument + 1 */
+#define GEN_RESYNC_LEN 10
+#define GEN_GARBAGE_MAX 32
+#define GEN_CURSOR_STORM 32
+/* A frame starting this late was not sent at the requested rate */
+#define GEN_LATE_US 1000
+
+enum gen_kind {
+	GEN_REDRAW,
+	GEN_BARS,
+	GEN_SCROLL,
+	GEN_CURSOR,
+	GEN_GARBAGE,
+	GEN_NKIND,
+};
+
+static const char *gen_kind_str[GEN_NKIND] = {
+	[GEN_REDRAW] = "redraw",
+	[GEN_BARS] = "bars",
+	[GEN_SCROLL] = "scroll",
+	[GEN_CURSOR] = "cursor",
+	[GEN_GARBAGE] = "garbage",
+};
+
+static const char *gen_words[] = {
+	"cpu", "load", "mem", "swap", "eth0", "up", "down", "disk", "temp",
+	"fan", "rpm", "idle", "user", "sys", "nice", "iowait", "kB/s",
+	"uptime", "days", "lcdproc", "MtxOrb", "ok", "42%", "0.37", "99",
+};
+#define GEN_NWORDS (sizeof(gen_words) / sizeof(gen_words[0]))
+
+struct gen {
+	int nrows;
+	int ncolumns;
+	int weight[GEN_NKIND];
+	int weight_sum;
+	int frame;
+	/* Kind of bar chars the client defined, -1 none */
+	int cgram;
+	uint8_t buf[GEN_BUF_SIZE];
+	int len;
+	uint32_t frames[GEN_NKIND];
+	uint64_t bytes[GEN_NKIND];
+};
+
+static void gen_cmd(struct gen *g, const struct proto_cmd_data *d)
+{
+	int n = proto_mtxorb_encode(d, &g->buf[g->len], GEN_BUF_SIZE - g->len);
+
+	/* Frames are sized to fit, this is a bug of the generator */
+	if (n < 0) {
+		fprintf(stderr, "cannot encode %s: %s\n", proto_cmds_str[d->cmd],
+			strerror(-n));
+		exit(1);
+	}
+	g->len += n;
+}
+
+static void gen_simple(struct gen *g, enum proto_cmds cmd)
+{
+	struct proto_cmd_data d = { .cmd = cmd };
+
+	gen_cmd(g, &d);
+}
+
+/* len chars at r, c (zero based) */
+static void gen_text(struct gen *g, int r, int c, const char *s, int len)
+{
+	struct proto_cmd_data d = { .cmd = PROTO_CMD_TEXT };
+
+	if (len > g->ncolumns - c)
+		len = g->ncolumns - c;
+	d.data.text.row = r + 1;
+	d.data.text.col = c + 1;
+	d.data.text.len = len;
+	memcpy(d.data.text.buf, s, len);
+	gen_cmd(g, &d);
+}
+
+static void gen_redraw(struct gen *g)
+{
+	char line[PROTO_TEXT_MAX + 16];
+	int r, n;
+
+	if (!(rand() % 8))
+		gen_simple(g, PROTO_CMD_CLR_DISPLAY);
+	for (r = 0; r < g->nrows; r++) {
+		for (n = 0; n < g->ncolumns; )
+			n += sprintf(&line[n], "%s ", gen_words[rand() % GEN_NWORDS]);
+		gen_text(g, r, 0, line, g->ncolumns);
+	}
+}
+
+/* The chars lcdproc defines for its bars: 1 to 5 columns lit for the
+ * horizontal ones, 1 to 8 rows lit from the bottom for the vertical ones */
+static void gen_bar_chars(struct gen *g, int vertical)
+{
+	struct proto_cmd_data d = { .cmd = PROTO_CMD_ADD_CUSTOM_CHAR };
+	int i, y;
+
+	for (i = 0; i < 8; i++) {
+		d.data.custom_char.idx = i;
+		for (y = 0; y < 8; y++) {
+			if (vertical)
+				d.data.custom_char.bmp[y] = y >= 7 - i ? 0x1f : 0;
+			else
+				d.data.custom_char.bmp[y] = (0x1f << (4 - i % 5)) & 0x1f;
+		}
+		gen_cmd(g, &d);
+	}
+	g->cgram = vertical;
+}
+
+static void gen_bars(struct gen *g)
+{
+	struct proto_cmd_data d = { 0 };
+	char line[PROTO_TEXT_MAX];
+	int r, c, len, vertical = rand() % 2;
+
+	if (rand() % 2) {
+		/* Placed by the translator, which takes the custom chars */
+		gen_simple(g, vertical ? PROTO_CMD_INIT_VBAR_WIDE : PROTO_CMD_INIT_HBAR);
+		g->cgram = -1;
+		for (r = 0; r < g->nrows; r++) {
+			if (vertical) {
+				d.cmd = PROTO_CMD_PLACE_VBAR;
+				d.data.bar.col = 1 + r * g->ncolumns / g->nrows;
+				d.data.bar.len = rand() % (g->nrows * 8 + 1);
+			} else {
+				d.cmd = PROTO_CMD_PLACE_HBAR;
+				d.data.bar.col = 1;
+				d.data.bar.row = r + 1;
+				d.data.bar.len = rand() % (g->ncolumns * 5 + 1);
+			}
+			gen_cmd(g, &d);
+		}
+		return;
+	}
+
+	/* Made of custom chars, defined again when the kind of bar changes */
+	if (g->cgram != vertical)
+		gen_bar_chars(g, vertical);
+	for (r = 0; r < g->nrows; r++) {
+		len = rand() % (g->ncolumns * 5 + 1);
+		for (c = 0; c < g->ncolumns; c++) {
+			if (vertical)
+				line[c] = rand() % 9 ? rand() % 8 : ' ';
+			else if (len >= (c + 1) * 5)
+				line[c] = 4;
+			else if (len > c * 5)
+				line[c] = len - c * 5 - 1;
+			else
+				line[c] = ' ';
+		}
+		gen_text(g, r, 0, line, g->ncolumns);
+	}
+}
+
+static void gen_scroll(struct gen *g)
+{
+	static const char *ticker =
+		"*** lcdgen ticker, one column per frame *** ";
+	char line[PROTO_TEXT_MAX];
+	int r, c, n = strlen(ticker);
+
+	/* Last row is a ticker, the others a log going up */
+	for (r = 0; r < g->nrows - 1; r++) {
+		c = snprintf(line, sizeof(line), "%06d %s %s", g->frame + r,
+			     gen_words[(g->frame + r) % GEN_NWORDS],
+			     gen_words[(g->frame + r) * 7 % GEN_NWORDS]);
+		memset(&line[c], ' ', sizeof(line) - c);
+		gen_text(g, r, 0, line, g->ncolumns);
+	}
+	for (c = 0; c < g->ncolumns; c++)
+		line[c] = ticker[(g->frame + c) % n];
+	gen_text(g, g->nrows - 1, 0, line, g->ncolumns);
+}
+
+static void gen_cursor(struct gen *g)
+{
+	static const enum proto_cmds moves[] = {
+		PROTO_CMD_CURSOR_LEFT, PROTO_CMD_CURSOR_RIGHT,
+		PROTO_CMD_SEND_CURSOR_HOME, PROTO_CMD_BLINK_CURSOR_ON,
+		PROTO_CMD_BLINK_CURSOR_OFF, PROTO_CMD_UNDERLINE_CURSOR_ON,
+		PROTO_CMD_UNDERLINE_CURSOR_OFF,
+	};
+	struct proto_cmd_data d = { 0 };
+	int i;
+
+	for (i = 0; i < GEN_CURSOR_STORM; i++) {
+		if (rand() % 4) {
+			d.cmd = PROTO_CMD_SET_CURSOR_POS;
+			d.data.pos.col = 1 + rand() % g->ncolumns;
+			d.data.pos.row = 1 + rand() % g->nrows;
+		} else {
+			d.cmd = moves[rand() % (sizeof(moves) / sizeof(moves[0]))];
+		}
+		gen_cmd(g, &d);
+		d.cmd = PROTO_CMD_ASCII;
+		d.data.ascii = '!' + rand() % ('~' - '!');
+		gen_cmd(g, &d);
+	}
+}
+
+static void gen_garbage(struct gen *g)
+{
+	int n = 1 + rand() % GEN_GARBAGE_MAX;
+
+	/* Headers are frequent so that commands get cut */
+	while (n--)
+		g->buf[g->len++] = rand() % 4 ? rand() : 0xfe;
+	memset(&g->buf[g->len], ' ', GEN_RESYNC_LEN);
+	g->len += GEN_RESYNC_LEN;
+	gen_simple(g, PROTO_CMD_CLR_DISPLAY);
+}
+
+static int gen_frame(struct gen *g)
+{
+	int kind, w = rand() % g->weight_sum;
+
+	for (kind = 0; w >= g->weight[kind]; kind++)
+		w -= g->weight[kind];
+
+	g->len = 0;
+	switch (kind) {
+	case GEN_REDRAW:
+		gen_redraw(g);
+		break;
+	case GEN_BARS:
+		gen_bars(g);
+		break;
+	case GEN_SCROLL:
+		gen_scroll(g);
+		break;
+	case GEN_CURSOR:
+		gen_cursor(g);
+		break;
+	case GEN_GARBAGE:
+		gen_garbage(g);
+		break;
+	}
+	g->frame++;
+	g->frames[kind]++;
+	g->bytes[kind] += g->len;
+	return g->len;
+}
+
+static int gen_parse_mix(struct gen *g, const char *mix)
+{
+	char *list = strdup(mix), *tok, *save, *w;
+	int kind, ret = 0;
+
+	memset(g->weight, 0, sizeof(g->weight));
+	g->weight_sum = 0;
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		w = strchr(tok, ':');
+		if (w)
+			*w++ = '\0';
+		for (kind = 0; kind < GEN_NKIND; kind++) {
+			if (!strcmp(tok, gen_kind_str[kind]))
+				break;
+		}
+		if (kind == GEN_NKIND || (w && atoi(w) < 0)) {
+			ret = -EINVAL;
+			goto exit_parse;
+		}
+		g->weight[kind] = w ? atoi(w) : 1;
+		g->weight_sum += g->weight[kind];
+	}
+	if (!g->weight_sum)
+		ret = -EINVAL;
+exit_parse:
+	free(list);
+	return ret;
+}
+
+static speed_t gen_speed(int baud)
+{
+	switch (baud) {
+	case 1200: return B1200;
+	case 2400: return B2400;
+	case 4800: return B4800;
+	case 9600: return B9600;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	default: return B19200;
+	}
+}
+
+static int gen_open(const char *output, int baud, int *line_paced)
+{
+	char name[64];
+	int fd, slave;
+
+	*line_paced = 0;
+	if (!strcmp(output, "-"))
+		return STDOUT_FILENO;
+	if (!strcmp(output, "pty")) {
+		if (openpty(&fd, &slave, name, NULL, NULL) < 0)
+			return -errno;
+		/* Raw as the server port of lcdlator. The slave is kept open
+		 * so that nothing is lost before the translator opens it. */
+		tty_set_attribs(slave, B19200);
+		tty_set_attribs(fd, B19200);
+		fprintf(stderr, "pty: %s\n", name);
+		return fd;
+	}
+	fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY, 0644);
+	if (fd < 0)
+		return -errno;
+	if (isatty(fd)) {
+		tty_set_attribs(fd, gen_speed(baud));
+		*line_paced = 1;
+	}
+	return fd;
+}
+
+static int gen_write(int fd, const uint8_t *buf, int len)
+{
+	int n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = "-", *geometry = "20x4",
+		*mix = "redraw:4,bars:2,scroll:2,cursor:1,garbage:0";
+	struct gen g = { .cgram = -1 };
+	uint64_t start, now, next, line = 0, total = 0;
+	int frames = 1000, seconds = 0, rate = 0, baud = 0, seed = 1;
+	int fd, line_paced, late = 0, opt, kind, len, ret;
+	double elapsed;
+
+	while ((opt = getopt(argc, argv, "o:b:r:n:t:g:m:s:")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baud = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			frames = 0;
+			break;
+		case 'g':
+			geometry = optarg;
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			goto exit_usage;
+		}
+	}
+	if (sscanf(geometry, "%dx%d", &g.ncolumns, &g.nrows) != 2 ||
+	    g.nrows < 1 || g.nrows > LCD_MAX_NROWS || g.ncolumns < 1 ||
+	    g.ncolumns > LCD_MAX_NCOLUMNS || gen_parse_mix(&g, mix) < 0 ||
+	    baud < 0 || rate < 0)
+		goto exit_usage;
+
+	fd = gen_open(output, baud, &line_paced);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", output, strerror(-fd));
+		return 1;
+	}
+	/* The kernel paces a real tty */
+	if (line_paced)
+		baud = 0;
+
+	srand(seed);
+	start = next = time_us();
+	while (frames ? g.frame < frames :
+	       time_us() - start < (uint64_t)seconds * 1000000) {
+		len = gen_frame(&g);
+		now = time_us();
+		if (rate) {
+			if (now > next + GEN_LATE_US)
+				late++;
+			else if (now < next)
+				usleep(next - now);
+			next += 1000000 / rate;
+		}
+		ret = gen_write(fd, g.buf, len);
+		if (ret < 0) {
+			fprintf(stderr, "write: %s\n", strerror(-ret));
+			break;
+		}
+		total += len;
+		if (baud) {
+			/* The line is busy until the frame is out */
+			now = time_us();
+			if (line < now)
+				line = now;
+			line += (uint64_t)len * GEN_BITS_PER_BYTE * 1000000 / baud;
+			if (line > now)
+				usleep(line - now);
+		}
+	}
+	elapsed = (time_us() - start) / 1e6;
+
+	for (kind = 0; kind < GEN_NKIND; kind++) {
+		if (g.frames[kind])
+			fprintf(stderr, "%-8s %8u frames %10llu bytes\n",
+				gen_kind_str[kind], g.frames[kind],
+				(unsigned long long)g.bytes[kind]);
+	}
+	fprintf(stderr, "%d frames, %llu bytes in %.2f s: %.0f frames/s %.0f bytes/s",
+		g.frame, (unsigned long long)total, elapsed, g.frame / elapsed,
+		total / elapsed);
+	if (rate)
+		fprintf(stderr, ", %d late", late);
+	fprintf(stderr, "\n");
+	if (fd != STDOUT_FILENO)
+		close(fd);
+	return 0;
+
+exit_usage:
+	fprintf(stderr, "usage: %s [-o <output>] [-b <baud>] [-r <frames/s>] "
+		"[-n frames] [-t seconds] [-g <columns>x<rows>] "
+		"[-m <kind>:<weight>[,...]] [-s seed]\n", argv[0]);
+	return 1;
+}
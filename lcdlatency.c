@@ -0,0 +1,346 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* End to end latency of the translator on its own pty pair: a synthetic
+ * client sends at a fixed rate over an emulated serial line, the
+ * translator side goes through the tty, the parser and a display
+ * backend with the input code of main() (input.c).
+ *
+ * lcdlatency [-d <client port>] [-b <baud>[,<baud>...]] [-t <ms>] [-l <ms>]
+ *
+ * -d: display, as the client port of lcdlator (default ansi:/dev/null)
+ * -b: emulated line speeds
+ * -t: duration of each rate step
+ * -l: lag beyond which a rate is not sustainable
+ *
+ * Each command is a row of text carrying its sequence number. It is
+ * stamped when its last byte is on the line and again once the backend
+ * has been flushed after parsing it, even if a later row superseded it
+ * and the command queue shed it ("shed" counts those). For each speed
+ * the rate is doubled until commands get lost (the pty is full, as a
+ * UART overrun would do), lag too much or the line is saturated.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "cmdq.h"
+#include "ctrl.h"
+#include "input.h"
+#include "lcd_geometry.h"
+#include "proto.h"
+#include "utils.h"
+
+/* Commands parsed between two flushes that are tracked */
+#define LAT_PENDING_MAX 1024
+#define LAT_RATE_MIN 10
+/* Input quiet for this long ends a step */
+#define LAT_GRACE_MS 500
+/* Start bit, 8 data bits, stop bit */
+#define LAT_BITS_PER_BYTE 10
+#define LAT_MARK '#'
+
+struct lat_step {
+	int fd;
+	int baud;
+	int rate;
+	int nrows;
+	int ncolumns;
+	int count;
+	/* Send time of each command, 0 if it could not be sent */
+	uint64_t *sent_us;
+	uint8_t *received;
+	/* Sender thread results */
+	int lost;
+	int line_limited;
+	volatile int done;
+};
+
+static int lat_cmd(uint8_t *buf, int seq, int nrows, int ncolumns)
+{
+	int len = 0;
+
+	buf[len++] = 0xfe;
+	buf[len++] = 0x47; /* cursor position */
+	buf[len++] = 1;
+	buf[len++] = seq % nrows + 1;
+	memset(&buf[len], '.', ncolumns);
+	snprintf((char *)&buf[len], ncolumns, "%c%07d", LAT_MARK, seq);
+	buf[len + 8] = ' ';
+	return len + ncolumns;
+}
+
+/* The client: command k is due at k / rate, the line takes
+ * LAT_BITS_PER_BYTE / baud for each byte and the command is written
+ * when its last byte would be in. */
+static void *lat_sender(void *arg)
+{
+	struct lat_step *st = arg;
+	uint8_t buf[8 + LCD_MAX_NCOLUMNS];
+	uint64_t start = time_us(), line = start, due, now;
+	int k, len, ret;
+
+	for (k = 0; k < st->count; k++) {
+		len = lat_cmd(buf, k, st->nrows, st->ncolumns);
+		due = start + (uint64_t)k * 1000000 / st->rate;
+		if (line < due)
+			line = due;
+		line += (uint64_t)len * LAT_BITS_PER_BYTE * 1000000 / st->baud;
+		/* More than a period late: the rate is beyond the line */
+		if (line - due > (uint64_t)(1000000 / st->rate))
+			st->line_limited = 1;
+		now = time_us();
+		if (line > now)
+			usleep(line - now);
+
+		st->sent_us[k] = time_us();
+		ret = write(st->fd, buf, len);
+		if (ret < len) {
+			/* The rest of the command is dropped */
+			st->sent_us[k] = 0;
+			st->lost++;
+		}
+	}
+	st->done = 1;
+	return NULL;
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* What the translator side parsed, by the mark of each row */
+struct lat_rx {
+	struct lat_step *st;
+	/* Start of the row being received, reads can split a text run */
+	char mark[9];
+	int nmark;
+	/* Parsed, not yet on the display */
+	int pending[LAT_PENDING_MAX];
+	int npending;
+};
+
+static void lat_parsed(void *ctx, const struct proto_cmd_data *d)
+{
+	struct lat_rx *r = ctx;
+	int seq, i;
+
+	if (d->cmd == PROTO_CMD_SET_CURSOR_POS) {
+		r->nmark = 0;
+		return;
+	}
+	if (d->cmd != PROTO_CMD_TEXT || r->nmark >= 8)
+		return;
+	for (i = 0; i < d->data.text.len && r->nmark < 8; i++)
+		r->mark[r->nmark++] = d->data.text.buf[i];
+	r->mark[r->nmark] = '\0';
+	if (r->nmark == 8 && r->mark[0] == LAT_MARK &&
+	    sscanf(&r->mark[1], "%7d", &seq) == 1 &&
+	    seq >= 0 && seq < r->st->count && !r->st->received[seq] &&
+	    r->npending < LAT_PENDING_MAX)
+		r->pending[r->npending++] = seq;
+}
+
+/* The translator side, until the sender is done and the input is quiet */
+static int lat_receive(struct lat_step *st, int fd, struct input *in,
+		       uint32_t *lat)
+{
+	struct lat_rx r = { .st = st };
+	int nlat = 0, timeout = -1, ret, i;
+	uint32_t quiet = time_ms();
+	uint64_t now;
+
+	in->parsed = lat_parsed;
+	in->ctx = &r;
+	while (!st->done || time_ms() - quiet < LAT_GRACE_MS) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		ret = poll(&pfd, 1, timeout >= 0 && timeout < 10 ? timeout : 10);
+		if (ret <= 0) {
+			timeout = input_flush(in);
+		} else {
+			if (input_read(in, fd) <= 0)
+				continue;
+			quiet = time_ms();
+			if (!input_process(in, fd, &timeout))
+				continue;
+		}
+
+		now = time_us();
+		for (i = 0; i < r.npending; i++) {
+			st->received[r.pending[i]] = 1;
+			if (st->sent_us[r.pending[i]])
+				lat[nlat++] = now - st->sent_us[r.pending[i]];
+		}
+		r.npending = 0;
+	}
+	in->parsed = NULL;
+	return nlat;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *display = "ansi:/dev/null", *bauds = "9600,19200,57600,115200";
+	int step_ms = 1000, max_lag_ms = 100;
+	struct mtxorb_hndl *mtxorb = NULL;
+	struct proto_cmd_ops ops;
+	struct ctrl lcd = { 0 };
+	struct cmdq *q = NULL;
+	static struct input in;
+	struct cmdq_stats qst;
+	uint8_t nrows, ncolumns;
+	uint32_t shed;
+	int master, slave, opt, ret = 1;
+	char *list, *save, *tok;
+
+	while ((opt = getopt(argc, argv, "d:b:t:l:")) != -1) {
+		switch (opt) {
+		case 'd':
+			display = optarg;
+			break;
+		case 'b':
+			bauds = optarg;
+			break;
+		case 't':
+			step_ms = atoi(optarg);
+			break;
+		case 'l':
+			max_lag_ms = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d <client port>] "
+				"[-b <baud>[,<baud>...]] [-t <ms>] [-l <ms>]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	/* Every step must send at least one command */
+	if (step_ms <= 0 || (uint64_t)LAT_RATE_MIN * step_ms / 1000 == 0) {
+		fprintf(stderr, "-t must be at least %d ms\n",
+			(1000 + LAT_RATE_MIN - 1) / LAT_RATE_MIN);
+		return 1;
+	}
+	if (max_lag_ms < 0) {
+		fprintf(stderr, "-l must not be negative\n");
+		return 1;
+	}
+
+	log_init(0);
+	if (openpty(&master, &slave, NULL, NULL, NULL) < 0) {
+		perror("openpty");
+		return 1;
+	}
+	/* Raw, as the server port; the client side must never block */
+	tty_set_attribs(slave, B19200);
+	tty_set_attribs(master, B19200);
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+	if (ctrl_open(&lcd, display, NULL) < 0 ||
+	    proto_mtxorb_init(&mtxorb, &ops) < 0)
+		goto exit_init;
+	lcd.ops->geometry(lcd.hndl, &nrows, &ncolumns);
+	if (ncolumns < 10) {
+		fprintf(stderr, "display too narrow\n");
+		goto exit_init;
+	}
+	q = cmdq_init(nrows, ncolumns);
+	if (!q)
+		goto exit_init;
+	input_init(&in, mtxorb, &ops, q, &lcd);
+
+	printf("%8s %8s %7s %5s %6s %9s %9s %9s\n", "baud", "cmd/s", "sent",
+	       "lost", "shed", "p50 us", "p99 us", "max us");
+	list = strdup(bauds);
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		struct lat_step st = { .fd = master, .baud = atoi(tok),
+				       .nrows = nrows, .ncolumns = ncolumns };
+		int rate, best = 0;
+
+		if (st.baud <= 0)
+			continue;
+		for (rate = LAT_RATE_MIN; ; rate *= 2) {
+			pthread_t th;
+			uint32_t *lat;
+			int nlat, lost, ok;
+
+			st.rate = rate;
+			st.count = (uint64_t)rate * step_ms / 1000;
+			st.lost = 0;
+			st.line_limited = 0;
+			st.done = 0;
+			st.sent_us = calloc(st.count, sizeof(*st.sent_us));
+			st.received = calloc(st.count, 1);
+			lat = calloc(st.count, sizeof(*lat));
+			if (!st.sent_us || !st.received || !lat ||
+			    pthread_create(&th, NULL, lat_sender, &st)) {
+				fprintf(stderr, "out of memory\n");
+				goto exit_init;
+			}
+			cmdq_stats(q, &qst);
+			shed = qst.shed_text + qst.shed_cursor;
+			nlat = lat_receive(&st, slave, &in, lat);
+			pthread_join(th, NULL);
+			cmdq_stats(q, &qst);
+			shed = qst.shed_text + qst.shed_cursor - shed;
+
+			qsort(lat, nlat, sizeof(*lat), lat_cmp);
+			lost = st.count - nlat;
+			ok = !lost && !st.line_limited && nlat &&
+			     lat[nlat - 1] <= (uint32_t)max_lag_ms * 1000;
+			printf("%8d %8d %7d %5d %6u %9u %9u %9u%s\n", st.baud,
+			       rate, st.count, lost, shed,
+			       nlat ? lat[nlat / 2] : 0,
+			       nlat ? lat[nlat * 99 / 100] : 0,
+			       nlat ? lat[nlat - 1] : 0,
+			       st.line_limited ? " line saturated" :
+			       lost ? " lost" : ok ? "" : " lagging");
+			free(st.sent_us);
+			free(st.received);
+			free(lat);
+			if (!ok)
+				break;
+			best = rate;
+		}
+		printf("%8d max sustainable %d cmd/s\n", st.baud, best);
+	}
+	free(list);
+	ret = 0;
+
+exit_init:
+	cmdq_deinit(q);
+	proto_mtxorb_deinit(mtxorb);
+	if (lcd.hndl)
+		lcd.ops->deinit(lcd.hndl);
+	close(master);
+	close(slave);
+	log_deinit();
+	return ret;
+}
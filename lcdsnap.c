@@ -0,0 +1,151 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Dump what the translator is showing on the display.
+ *
+ * lcdsnap [-n shm name] [-g] [-a max age ms] [-w period ms]
+ *  -g: dump custom chars bitmaps too
+ *  -a: exit with 2 when the screen did not change for more than max age
+ *  -w: keep dumping every period ms
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "snapshot.h"
+#include "utils.h"
+
+/* snapshot_read() attempts before giving up on a dump */
+#define SNAP_READ_TRIES 5
+#define SNAP_READ_WAIT_US 1000
+
+static void snap_border(int ncolumns)
+{
+	int c;
+
+	printf("+");
+	for (c = 0; c < ncolumns; c++)
+		printf("-");
+	printf("+\n");
+}
+
+static void snap_dump(const struct lcd_snapshot *snap, int glyphs, int tty)
+{
+	int r, c, i;
+
+	snap_border(snap->ncolumns);
+	for (r = 0; r < snap->nrows; r++) {
+		printf("|");
+		for (c = 0; c < snap->ncolumns; c++) {
+			uint8_t ch = snap->cells[r][c];
+
+			/* custom chars are shown as their index */
+			if (ch < SCREEN_NGLYPHS)
+				printf(tty ? "\033[7m%c\033[0m" : "%c", '0' + ch);
+			else
+				printf("%c", isprint(ch) ? ch : '.');
+		}
+		printf("|\n");
+	}
+	snap_border(snap->ncolumns);
+	printf("cursor: %d,%d%s%s frame: %u age: %u ms\n", snap->row, snap->col,
+	       snap->flags & SCREEN_F_BLINK ? " blink" : "",
+	       snap->flags & SCREEN_F_UNDERLINE ? " underline" : "",
+	       snap->frame, time_ms() - snap->update_ms);
+
+	if (!glyphs)
+		return;
+	for (r = 0; r < 8; r++) {
+		for (i = 0; i < SCREEN_NGLYPHS; i++) {
+			if (!(snap->glyph_mask & (1 << i)))
+				continue;
+			for (c = 4; c >= 0; c--)
+				printf("%c", snap->glyphs[i][r] & (1 << c) ? '#' : '.');
+			printf(" ");
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = SNAPSHOT_SHM_NAME;
+	struct lcd_snapshot snap;
+	struct snapshot *s;
+	int glyphs = 0, max_age = -1, period = -1;
+	int opt, ret, i;
+
+	while ((opt = getopt(argc, argv, "n:ga:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'g':
+			glyphs = 1;
+			break;
+		case 'a':
+			max_age = atoi(optarg);
+			break;
+		case 'w':
+			period = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n shm name] [-g] [-a max age ms] "
+				"[-w period ms]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	s = snapshot_open(name);
+	if (!s)
+		return 1;
+
+	do {
+		/* Only a publisher going flat out keeps it busy, give it a
+		 * moment */
+		for (i = 0; i < SNAP_READ_TRIES; i++) {
+			ret = snapshot_read(s, &snap);
+			if (ret != -EAGAIN)
+				break;
+			usleep(SNAP_READ_WAIT_US);
+		}
+		if (ret < 0) {
+			fprintf(stderr, "snapshot busy%s\n",
+				period >= 0 ? ", retrying" : "");
+		} else if (!snap.frame) {
+			printf("nothing published yet\n");
+		} else {
+			if (period >= 0)
+				printf("\033[H\033[2J");
+			snap_dump(&snap, glyphs, isatty(STDOUT_FILENO));
+			if (max_age >= 0 && time_ms() - snap.update_ms > (uint32_t)max_age) {
+				printf("screen frozen\n");
+				ret = 2;
+				break;
+			}
+		}
+		if (period >= 0)
+			usleep(period * 1000);
+	} while (period >= 0);
+
+	snapshot_deinit(s);
+	return ret < 0 ? 1 : ret;
+}
@@ -0,0 +1,440 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "log.h"
+#include "utils.h"
+
+#define LOG_MAX_ARGS 6
+#define LOG_STR_LEN 64 /* room for copied %s arguments, per record */
+#define LOG_LINE_LEN 160
+#define LOG_FLUSH_MS 50
+
+#if (LOG_RING_SIZE & (LOG_RING_SIZE - 1))
+#  error "LOG_RING_SIZE must be a power of 2"
+#endif
+
+enum log_arg_type {
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_SIZE,
+	LOG_ARG_PTR,
+	LOG_ARG_STR,
+	LOG_ARG_DBL,
+};
+
+union log_arg {
+	long long ll;
+	double d;
+	const void *p;
+};
+
+struct log_rec {
+	/* Slot sequence: tells producers and the consumer who owns the slot */
+	uint32_t seq;
+	uint32_t ts_ms;
+	const struct log_site *site;
+	uint16_t suppressed;
+	union log_arg arg[LOG_MAX_ARGS];
+	char str[LOG_STR_LEN];
+};
+
+int log_level = LOG_LVL_INFO < LOG_LEVEL_MAX ? LOG_LVL_INFO : LOG_LEVEL_MAX;
+
+static struct log_rec ring[LOG_RING_SIZE];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static uint32_t ring_dropped;
+
+static int log_async;
+static volatile int log_run;
+static pthread_t log_thread;
+/* Serialize consumers (background thread and log_flush callers) */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static int log_line_start = 1;
+
+/* Parse a conversion spec, p points just after '%'.
+ * The spec is copied into spec (including '%') and the type of argument it
+ * consumes is returned in type. Width and precision given as '*' are not
+ * supported.
+ */
+static const char *log_parse_spec(const char *p, char *spec, int spec_size,
+				  int *type)
+{
+	int n = 0, lng = 0, size = 0;
+	char conv;
+
+	spec[n++] = '%';
+	while (*p && strchr("-+ #0123456789.hlzjt", *p)) {
+		if (*p == 'l')
+			lng++;
+		if (*p == 'z' || *p == 't')
+			size = 1;
+		if (*p == 'j')
+			lng = 2;
+		if (n < spec_size - 2)
+			spec[n++] = *p;
+		p++;
+	}
+	conv = *p;
+	if (conv)
+		p++;
+	spec[n++] = conv;
+	spec[n] = '\0';
+
+	switch (conv) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	case 'c':
+		if (size)
+			*type = LOG_ARG_SIZE;
+		else if (lng >= 2)
+			*type = LOG_ARG_LLONG;
+		else if (lng == 1)
+			*type = LOG_ARG_LONG;
+		else
+			*type = LOG_ARG_INT;
+		break;
+	case 's':
+		*type = LOG_ARG_STR;
+		break;
+	case 'p':
+		*type = LOG_ARG_PTR;
+		break;
+	case 'f':
+	case 'e':
+	case 'g':
+	case 'E':
+	case 'G':
+		*type = LOG_ARG_DBL;
+		break;
+	default:
+		/* '%%' or garbage */
+		*type = LOG_ARG_NONE;
+		break;
+	}
+	return p;
+}
+
+static int log_ratelimit(struct log_site *site)
+{
+	uint32_t now = time_ms();
+
+	if (now - site->window_ms >= 1000) {
+		site->window_ms = now;
+		site->count = 0;
+	}
+	if (site->count >= LOG_RATE) {
+		if (site->suppressed < UINT16_MAX)
+			site->suppressed++;
+		return 0;
+	}
+	site->count++;
+	return 1;
+}
+
+static struct log_rec *log_reserve(void)
+{
+	uint32_t pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	struct log_rec *r;
+
+	for (;;) {
+		int32_t dif;
+
+		r = &ring[pos & (LOG_RING_SIZE - 1)];
+		dif = (int32_t)(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				return r;
+		} else if (dif < 0) {
+			/* Full: never wait on the consumer */
+			__atomic_fetch_add(&ring_dropped, 1, __ATOMIC_RELAXED);
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void log_commit(struct log_rec *r)
+{
+	uint32_t pos = r->seq;
+
+	__atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void log_record(struct log_site *site, ...)
+{
+	struct log_rec *r;
+	const char *p;
+	char spec[16];
+	int type, i = 0, str_used = 0;
+	va_list ap;
+
+	if (!log_ratelimit(site))
+		return;
+
+	if (!log_async) {
+		if (site->suppressed) {
+			fprintf(stderr, "[%u messages suppressed]\n", site->suppressed);
+			site->suppressed = 0;
+		}
+		va_start(ap, site);
+		vfprintf(stderr, site->fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	r = log_reserve();
+	if (!r)
+		return;
+
+	r->ts_ms = time_ms();
+	r->site = site;
+	r->suppressed = site->suppressed;
+	site->suppressed = 0;
+
+	va_start(ap, site);
+	for (p = site->fmt; *p && i < LOG_MAX_ARGS; ) {
+		if (*p++ != '%')
+			continue;
+		p = log_parse_spec(p, spec, sizeof(spec), &type);
+		switch (type) {
+		case LOG_ARG_NONE:
+			continue;
+		case LOG_ARG_INT:
+			r->arg[i].ll = va_arg(ap, int);
+			break;
+		case LOG_ARG_LONG:
+			r->arg[i].ll = va_arg(ap, long);
+			break;
+		case LOG_ARG_LLONG:
+			r->arg[i].ll = va_arg(ap, long long);
+			break;
+		case LOG_ARG_SIZE:
+			r->arg[i].ll = va_arg(ap, size_t);
+			break;
+		case LOG_ARG_PTR:
+			r->arg[i].p = va_arg(ap, void *);
+			break;
+		case LOG_ARG_DBL:
+			r->arg[i].d = va_arg(ap, double);
+			break;
+		case LOG_ARG_STR: {
+			const char *s = va_arg(ap, const char *);
+			int len = s ? strlen(s) : 0;
+
+			/* What the strings before left */
+			if (len > LOG_STR_LEN - 1 - str_used)
+				len = LOG_STR_LEN - 1 - str_used;
+			if (len < 0)
+				len = 0;
+			memcpy(&r->str[str_used], s, len);
+			r->str[str_used + len] = '\0';
+			r->arg[i].ll = str_used;
+			str_used += len + 1;
+			if (str_used > LOG_STR_LEN - 1)
+				str_used = LOG_STR_LEN - 1;
+			break;
+		}
+		}
+		i++;
+	}
+	va_end(ap);
+
+	log_commit(r);
+}
+
+static int log_pop(struct log_rec *out)
+{
+	uint32_t pos = ring_tail;
+	struct log_rec *r = &ring[pos & (LOG_RING_SIZE - 1)];
+
+	if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return 0;
+	*out = *r;
+	__atomic_store_n(&r->seq, pos + LOG_RING_SIZE, __ATOMIC_RELEASE);
+	ring_tail = pos + 1;
+	return 1;
+}
+
+static void log_print(const struct log_rec *r)
+{
+	char line[LOG_LINE_LEN];
+	char spec[16];
+	const char *p = r->site->fmt;
+	int n = 0, i = 0, type;
+
+#define LOG_ROOM (n < (int)sizeof(line) ? (int)sizeof(line) - n : 0)
+#define LOG_APPEND(args...) do {					\
+		n += snprintf(&line[n < (int)sizeof(line) ? n : 0],	\
+			      LOG_ROOM, ##args);			\
+	} while (0)
+
+	if (r->suppressed) {
+		if (!log_line_start)
+			LOG_APPEND("\n");
+		LOG_APPEND("[%u messages suppressed]\n", r->suppressed);
+		log_line_start = 1;
+	}
+	if (log_line_start)
+		LOG_APPEND("[%5u.%03u] ", r->ts_ms / 1000, r->ts_ms % 1000);
+
+	while (*p) {
+		const char *lit = p;
+
+		while (*p && *p != '%')
+			p++;
+		if (p != lit)
+			LOG_APPEND("%.*s", (int)(p - lit), lit);
+		if (!*p)
+			break;
+		p = log_parse_spec(p + 1, spec, sizeof(spec), &type);
+		if (type == LOG_ARG_NONE) {
+			if (spec[1] == '%')
+				LOG_APPEND("%%");
+			continue;
+		}
+		if (i >= LOG_MAX_ARGS) {
+			LOG_APPEND("?");
+			continue;
+		}
+		switch (type) {
+		case LOG_ARG_INT:
+			LOG_APPEND(spec, (int)r->arg[i].ll);
+			break;
+		case LOG_ARG_LONG:
+			LOG_APPEND(spec, (long)r->arg[i].ll);
+			break;
+		case LOG_ARG_LLONG:
+			LOG_APPEND(spec, r->arg[i].ll);
+			break;
+		case LOG_ARG_SIZE:
+			LOG_APPEND(spec, (size_t)r->arg[i].ll);
+			break;
+		case LOG_ARG_PTR:
+			LOG_APPEND(spec, r->arg[i].p);
+			break;
+		case LOG_ARG_DBL:
+			LOG_APPEND(spec, r->arg[i].d);
+			break;
+		case LOG_ARG_STR:
+			LOG_APPEND(spec, &r->str[r->arg[i].ll]);
+			break;
+		}
+		i++;
+	}
+#undef LOG_APPEND
+#undef LOG_ROOM
+
+	if (n >= (int)sizeof(line)) {
+		n = sizeof(line) - 1;
+		line[n - 1] = '\n';
+	}
+	if (n > 0)
+		log_line_start = line[n - 1] == '\n';
+	fputs(line, stderr);
+}
+
+void log_flush(void)
+{
+	struct log_rec r;
+	uint32_t dropped;
+
+	pthread_mutex_lock(&log_lock);
+	while (log_pop(&r))
+		log_print(&r);
+	dropped = __atomic_exchange_n(&ring_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		fprintf(stderr, "%s[%u log records dropped]\n",
+			log_line_start ? "" : "\n", dropped);
+		log_line_start = 1;
+	}
+	pthread_mutex_unlock(&log_lock);
+}
+
+static void *log_thread_main(void *arg)
+{
+	(void)arg;
+	while (log_run) {
+		usleep(LOG_FLUSH_MS * 1000);
+		log_flush();
+	}
+	return NULL;
+}
+
+void log_set_level(int level)
+{
+	if (level > LOG_LEVEL_MAX)
+		level = LOG_LEVEL_MAX;
+	if (level < LOG_LVL_NONE)
+		level = LOG_LVL_NONE;
+	log_level = level;
+}
+
+int log_init(int async)
+{
+	const char *env = getenv("LCD_TRANSLATOR_LOG_LEVEL");
+	uint32_t i;
+	int ret;
+
+	if (env)
+		log_set_level(atoi(env));
+
+	if (!async || log_async)
+		return 0;
+
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		ring[i].seq = i;
+	ring_head = ring_tail = 0;
+
+	log_run = 1;
+	log_async = 1;
+	ret = pthread_create(&log_thread, NULL, log_thread_main, NULL);
+	if (ret) {
+		log_run = 0;
+		log_async = 0;
+		return -ret;
+	}
+	return 0;
+}
+
+void log_deinit(void)
+{
+	if (!log_async)
+		return;
+	log_run = 0;
+	pthread_join(log_thread, NULL);
+	log_flush();
+	log_async = 0;
+}
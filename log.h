@@ -0,0 +1,101 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#ifdef __NuttX__
+#include <nuttx/config.h>
+#endif
+
+enum log_level {
+	LOG_LVL_NONE,
+	LOG_LVL_ERR,
+	LOG_LVL_INFO,
+	LOG_LVL_DBG,
+};
+
+/* Messages above this level are not even compiled in. */
+#ifdef CONFIG_LCD_TRANSLATOR_LOG_LEVEL
+#  define LOG_LEVEL_MAX CONFIG_LCD_TRANSLATOR_LOG_LEVEL
+#else
+#  define LOG_LEVEL_MAX LOG_LVL_DBG
+#endif
+
+/* Records the ring can hold before new messages get dropped (power of 2) */
+#ifdef CONFIG_LCD_TRANSLATOR_LOG_RING
+#  define LOG_RING_SIZE CONFIG_LCD_TRANSLATOR_LOG_RING
+#else
+#  define LOG_RING_SIZE 64
+#endif
+
+/* Messages per second allowed for each call site, bursts included */
+#ifdef CONFIG_LCD_TRANSLATOR_LOG_RATE
+#  define LOG_RATE CONFIG_LCD_TRANSLATOR_LOG_RATE
+#else
+#  define LOG_RATE 20
+#endif
+
+/* One per call site, the format string must be a literal. */
+struct log_site {
+	uint8_t level;
+	const char *fmt;
+	/* rate limiting */
+	uint32_t window_ms;
+	uint16_t count;
+	uint16_t suppressed;
+};
+
+extern int log_level;
+
+/* Never called, lets the compiler check the arguments against fmt:
+ * log_record() reads them as fmt says. */
+static inline void __attribute__((format(printf, 1, 2)))
+log_check_fmt(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
+#define log_msg(lvl, fmt, args...) do {					\
+	static struct log_site __log_site = { (lvl), (fmt), 0, 0, 0 };	\
+	if (0)								\
+		log_check_fmt(fmt, ##args);				\
+	if ((lvl) <= LOG_LEVEL_MAX && (lvl) <= log_level)		\
+		log_record(&__log_site, ##args);			\
+} while (0)
+
+/* Only arguments are stored, formatting is done later by log_flush().
+ * Strings (%s) are copied, 63 chars in all per record, everything else is
+ * kept raw.
+ */
+void log_record(struct log_site *site, ...);
+
+/* async: format and print records from a background thread, otherwise
+ * every message is printed by the caller as soon as it is recorded.
+ * The runtime level is taken from LCD_TRANSLATOR_LOG_LEVEL env if set.
+ */
+int log_init(int async);
+void log_deinit(void);
+void log_set_level(int level);
+/* Format and print all the pending records */
+void log_flush(void);
+
+#endif /* LOG_H */
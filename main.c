@@ -24,53 +24,307 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
-#include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
 #include "utils.h"
 #include "proto.h"
-#include "circ_buf.h"
-#include "ctrl_slcd.h"
+#include "cmdq.h"
+#include "input.h"
+#include "ctrl.h"
+#include "ctrl_ansi.h"
+#include "compositor.h"
+#include "charset.h"
 
-#define BUF_SIZE (1 << 10) /* Must be power of 2 */
+#define SERVER_OPEN_TIMEOUT_MS 10000
+/* Server port lost: how often to look for it again */
+#define SERVER_RETRY_MS 100
 
 struct cfg_params {
 	char *server_port;
 	char *client_port;
+	/* Display ROM name or charset file, NULL for the default */
+	char *charset;
+	/* server_port split in a list of ports, their protocol and their
+	 * compositor specs. They point in server_list, freed at exit. */
+	char *server_list;
+	char *server_ports[COMP_MAX_CLIENTS];
+	enum proto_type server_protos[COMP_MAX_CLIENTS];
+	char *server_specs[COMP_MAX_CLIENTS];
+	int nservers;
 };
 
-static int init_server(int *fd_server, const struct cfg_params *cfg)
+struct server_init {
+	const struct cfg_params *cfg;
+	int fd[COMP_MAX_CLIENTS];
+	int ret;
+	uint32_t ready_ms;
+};
+
+static int init_server(int *fd_server, const char *server_port)
 {
 	/* On NuttX, server tty might be available after this program tries to open
 	 * the device (usb enumeration).
-	 * Just busy waiting for the device.
+	 * Wait for the device, without sleeping longer than needed.
 	 */
-	int open_retry = 10;
-	do {
-		*fd_server = open(cfg->server_port, O_RDWR /*| O_NOCTTY | O_SYNC*/);
-		sleep(1);
-	} while(open_retry-- && *fd_server < 0);
+	*fd_server = dev_wait_open(server_port, O_RDWR /*| O_NOCTTY | O_SYNC*/,
+				   SERVER_OPEN_TIMEOUT_MS);
 	if (*fd_server < 0) {
-		error("Failed to open server port: %s\n", cfg->server_port);
-		return -errno;
+		error("Failed to open server port: %s\n", server_port);
+		return *fd_server;
 	}
 	tty_set_attribs(*fd_server, B19200);
 	return 0;
 }
 
-static int init_client(int *fd_client, const struct cfg_params *cfg)
+#ifdef __NuttX__
+/* Server ports list: [cfa:]port[@spec][,[cfa:]port[@spec]...]
+ * More than one port enables the compositor, spec is either the region
+ * of the display given to the port "@row:col:rows:cols" (zero based) or
+ * its priority "@pN" when the ports take turns on the whole display.
+ */
+static int cfg_parse_servers(struct cfg_params *cfg)
 {
-/* NuttX hardfault if it is not a tty! */
-	*fd_client = open(cfg->client_port, O_RDWR /*| O_NOCTTY | O_SYNC*/);
-	if (*fd_client < 0) {
-		error("Failed to open client port: %s\n", cfg->client_port);
-		return -errno;
+	char *save, *tok;
+	int ret = -EINVAL;
+
+	cfg->server_list = strdup(cfg->server_port);
+	if (!cfg->server_list)
+		return -ENOMEM;
+	cfg->nservers = 0;
+	for (tok = strtok_r(cfg->server_list, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *spec = strchr(tok, '@');
+
+		if (cfg->nservers >= COMP_MAX_CLIENTS) {
+			error("too many server ports, max %d\n", COMP_MAX_CLIENTS);
+			ret = -E2BIG;
+			goto exit_list;
+		}
+		if (spec)
+			*spec++ = '\0';
+		cfg->server_ports[cfg->nservers] =
+			proto_port(tok, &cfg->server_protos[cfg->nservers]);
+		cfg->server_specs[cfg->nservers] = spec;
+		cfg->nservers++;
 	}
-	tty_set_attribs(*fd_client, B19200);
+	if (cfg->nservers)
+		return 0;
+
+exit_list:
+	free(cfg->server_list);
+	cfg->server_list = NULL;
+	cfg->nservers = 0;
+	return ret;
+}
+
+static void *init_server_thread(void *arg)
+{
+	struct server_init *srv = arg;
+	int i;
+
+	for (i = 0; i < srv->cfg->nservers; i++) {
+		srv->ret = init_server(&srv->fd[i], srv->cfg->server_ports[i]);
+		if (srv->ret < 0)
+			break;
+	}
+	srv->ready_ms = time_ms();
+	return NULL;
+}
+
+static int comp_emit_lcd(void *ctx, const struct proto_cmd_data *cmd)
+{
+	struct ctrl *lcd = ctx;
+
+	return lcd->ops->cmd(lcd->hndl, cmd);
+}
+
+static struct compositor *init_compositor(const struct cfg_params *cfg,
+					  struct ctrl *lcd)
+{
+	enum comp_mode mode = COMP_MODE_REGION;
+	struct compositor *comp;
+	uint8_t nrows, ncolumns;
+	int i, row = 0;
+
+	lcd->ops->geometry(lcd->hndl, &nrows, &ncolumns);
+	for (i = 0; i < cfg->nservers; i++) {
+		/* Clients are parsed by the compositor itself */
+		if (cfg->server_protos[i] != PROTO_MTXORB) {
+			error("compositor clients must speak mtxorb: %s\n",
+			      cfg->server_ports[i]);
+			return NULL;
+		}
+		if (cfg->server_specs[i] && cfg->server_specs[i][0] == 'p')
+			mode = COMP_MODE_PRIORITY;
+	}
+
+	comp = compositor_init(mode, nrows, ncolumns, comp_emit_lcd, lcd);
+	if (!comp)
+		return NULL;
+
+	for (i = 0; i < cfg->nservers; i++) {
+		const char *spec = cfg->server_specs[i];
+		struct comp_region reg = { 0 };
+		unsigned r, c, nr, nc;
+		int prio = 0;
+
+		if (mode == COMP_MODE_PRIORITY) {
+			if (spec && spec[0] == 'p')
+				prio = atoi(&spec[1]);
+			if (prio < 0 || prio > UINT8_MAX)
+				goto exit_spec;
+		} else if (spec && sscanf(spec, "%u:%u:%u:%u", &r, &c, &nr, &nc) == 4) {
+			/* Checked before they are narrowed to the region fields */
+			if (r >= nrows || c >= ncolumns ||
+			    nr > nrows - r || nc > ncolumns - c)
+				goto exit_spec;
+			reg.row = r;
+			reg.col = c;
+			reg.nrows = nr;
+			reg.ncolumns = nc;
+		} else {
+			/* Share the rows among the ports left */
+			reg.row = row;
+			reg.col = 0;
+			reg.nrows = (nrows - row) / (cfg->nservers - i);
+			reg.ncolumns = ncolumns;
+		}
+		row = reg.row + reg.nrows;
+
+		if (compositor_add_client(comp, &reg, prio) < 0)
+			goto exit_spec;
+	}
+	return comp;
+
+exit_spec:
+	error("bad compositor spec for %s\n", cfg->server_ports[i]);
+	compositor_deinit(comp);
+	return NULL;
+}
+
+/* Errors telling the server port is gone (usb cable unplugged) */
+static int server_lost(int err)
+{
+	return err == EIO || err == ENODEV || err == ENXIO || err == ENOTCONN ||
+	       err == EPIPE;
+}
+
+/* Reopen a server port that went away, waiting at most timeout_ms for it */
+static int reopen_server(int *fd_server, const char *server_port,
+			 int timeout_ms)
+{
+	if (*fd_server >= 0) {
+		close(*fd_server);
+		*fd_server = -1;
+	}
+	*fd_server = dev_wait_open(server_port, O_RDWR, timeout_ms);
+	if (*fd_server < 0)
+		return *fd_server;
+	tty_set_attribs(*fd_server, B19200);
+	return 0;
+}
+
+/* Wait for the server port to come back. Parser and display state are
+ * kept: the client goes on from where it was and nothing is redrawn.
+ * Return 0, -EINTR when a signal stops the wait.
+ */
+static int reconnect_server(int *fd_server, const char *server_port,
+			    struct ctrl *lcd)
+{
+	static uint32_t last_ms;
+	uint32_t lost_ms = time_ms();
+	int ret;
+
+	info("server port lost, waiting for it\n");
+	/* A port that opens but fails at once must not spin */
+	if (lost_ms - last_ms < SERVER_RETRY_MS &&
+	    usleep((SERVER_RETRY_MS - (lost_ms - last_ms)) * 1000) < 0 &&
+	    errno == EINTR)
+		return -EINTR;
+
+	while ((ret = reopen_server(fd_server, server_port,
+				    SERVER_RETRY_MS)) < 0) {
+		if (ret == -EINTR)
+			return ret;
+		/* Keep on with pending redraws meanwhile */
+		lcd->ops->flush(lcd->hndl);
+	}
+
+	last_ms = time_ms();
+	info("server port back in %u ms\n", last_ms - lost_ms);
 	return 0;
 }
 
+static void run_compositor(struct server_init *srv, struct compositor *comp,
+			   struct ctrl *lcd)
+{
+	struct pollfd pfd[COMP_MAX_CLIENTS];
+	uint32_t lost_ms[COMP_MAX_CLIENTS];
+	uint8_t buf[64];
+	int nservers = srv->cfg->nservers;
+	int timeout = -1, resync, lost = 0;
+	int i;
+
+	for (i = 0; i < nservers; i++) {
+		pfd[i].fd = srv->fd[i];
+		pfd[i].events = POLLIN;
+	}
+
+	while (1) {
+		int ret = poll(pfd, nservers, timeout);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				break;
+			error("poll error: %d\n", -errno);
+			usleep(200*1000);
+			continue;
+		}
+		for (i = 0; i < nservers; i++) {
+			if (pfd[i].fd < 0) {
+				/* Lost ports are tried again without waiting, the
+				 * other clients must go on. */
+				if (time_ms() - lost_ms[i] < SERVER_RETRY_MS ||
+				    reopen_server(&srv->fd[i], srv->cfg->server_ports[i], 0) < 0)
+					continue;
+				info("server %d: back in %u ms\n", i, time_ms() - lost_ms[i]);
+				pfd[i].fd = srv->fd[i];
+				lost--;
+				continue;
+			}
+			if (!pfd[i].revents)
+				continue;
+			ret = read(pfd[i].fd, buf, sizeof(buf));
+			if (ret > 0) {
+				compositor_input(comp, i, buf, ret);
+			} else if (!ret || server_lost(errno)) {
+				info("server %d: lost, waiting for it\n", i);
+				close(srv->fd[i]);
+				srv->fd[i] = -1;
+				/* poll skips negative fds */
+				pfd[i].fd = -1;
+				lost_ms[i] = time_ms();
+				lost++;
+			} else if (errno != EINTR) {
+				error("server %d: read error: %d\n", i, -errno);
+			}
+		}
+		/* Only what changed since the last round reaches the display */
+		timeout = compositor_flush(comp);
+		resync = lcd->ops->flush(lcd->hndl);
+		if (resync >= 0 && (timeout < 0 || resync < timeout))
+			timeout = resync;
+		if (lost && (timeout < 0 || timeout > SERVER_RETRY_MS))
+			timeout = SERVER_RETRY_MS;
+	}
+}
+#endif /* __NuttX__ */
+
 /*
 socat -d -d pty,rawer,echo=0 pty,rawer,echo=0
 socat -d -d pty,rawer,echo=0,link=/tmp/pts0 pty,rawer,echo=0,link=/tmp/pts1
+
+Latency and sustainable rates are measured by lcdlatency on its own pty.
 */
 
 /* Linux only */
@@ -78,80 +332,94 @@ int main(int argc, char *argv[])
 {
 	static struct cfg_params cfg;
 	cfg.server_port = "/dev/ttyACM0";
-	cfg.client_port = "/dev/null";
-	int fd_server = -1, fd_client = -1;
-	struct mtxorb_hndl *mtxorb;
-	struct proto_cmd_ops mtxorb_ops;
+	cfg.client_port = ANSI_STDOUT;
+	int fd_server = -1;
+	void *proto = NULL;
+	struct proto_cmd_ops proto_ops;
+	struct ctrl lcd = { 0 };
+	struct cmdq *q = NULL;
+	static struct charset cs;
+	static struct input in;
+	uint8_t nrows, ncolumns;
+	uint32_t start;
+	int timeout = -1;
 
 	/* TODO: use getopt */
-	/* <app> [server port] [client port] */
-	if (argv[1])
+	/* <app> [[cfa:]server port] [client port] [charset] */
+	if (argc > 1)
 		cfg.server_port = argv[1];
-	if (argv[2])
+	if (argc > 2)
 		cfg.client_port = argv[2];
+	if (argc > 3)
+		cfg.charset = argv[3];
+	cfg.server_port = proto_port(cfg.server_port, &cfg.server_protos[0]);
 
-	if (init_server(&fd_server, &cfg) < 0)
+	log_init(1);
+	start = time_ms();
+
+	charset_init(&cs, CHARSET_DEFAULT);
+	if (cfg.charset && charset_parse(&cs, cfg.charset) < 0)
+		error("bad charset %s, using the default one\n", cfg.charset);
+
+	if (init_server(&fd_server, cfg.server_port) < 0)
 		goto exit_init;
 
-	if (init_client(&fd_client, &cfg) < 0)
+	if (ctrl_open(&lcd, cfg.client_port, &cs) < 0)
+		goto exit_init;
+	lcd.ops->geometry(lcd.hndl, &nrows, &ncolumns);
+	q = cmdq_init(nrows, ncolumns);
+	if (!q)
 		goto exit_init;
 
-	if (proto_mtxorb_init(&mtxorb, &mtxorb_ops) < 0)
+	if (proto_init(cfg.server_protos[0], &proto, &proto_ops) < 0)
 		goto exit_init;
+	input_init(&in, proto, &proto_ops, q, &lcd);
+	info("ready in %u ms\n", time_ms() - start);
 
 	while (1) {
-		char c;
+		struct pollfd pfd = { .fd = fd_server, .events = POLLIN };
 		int rret;
-		struct proto_cmd_data cdata;
-		/* Assume to have a blocking read */
-		rret = read(fd_server, &c , 1);
+
+		rret = poll(&pfd, 1, timeout);
+		if (!rret) {
+			timeout = input_flush(&in);
+			continue;
+		}
+		rret = rret > 0 ? input_read(&in, fd_server) : -errno;
 		if (rret < 0) {
-			if (errno == EINTR) {
+			if (rret == -EINTR)
 				break;
-			}
-			error("read error: %d\n", -errno);
+			error("read error: %d\n", rret);
 			usleep(200*1000);
+			continue;
 		}
 		if (!rret) {
 			info("eof\n");
 			break;
 		}
-#if 1
-		if (mtxorb_ops.parse_cmd(mtxorb, c, &cdata) == 1) {
-			if (cdata.cmd == PROTO_CMD_ASCII) {
-				if (isprint(cdata.data.ascii) || cdata.data.ascii == 0xa)
-					printf("%c", (unsigned char)cdata.data.ascii);
-				else
-					printf("\n0x%02x\n", (unsigned char)cdata.data.ascii);
-			} else {
-				printf("\nCMD: %s", proto_cmds_str[cdata.cmd]);
-				if (cdata.cmd == PROTO_CMD_SET_CURSOR_POS)
-					printf("[r: %02d c: %02d]", cdata.data.pos.row, cdata.data.pos.col);
-				printf("\n");
-			}
-		}
-#endif
-
-#if 0
-		if (isprint(c) || c == 0xa)
-			printf("%c", (unsigned char)c);
-		else
-			printf("\n0x%02x\n", (unsigned char)c);
-#endif
-
+		input_process(&in, fd_server, &timeout);
 	};
 
 exit_init:
-	proto_mtxorb_deinit(mtxorb);
+	if (in.q) {
+		input_flush(&in);
+		in.overloads = 0;
+		input_report(&in);
+	}
+	cmdq_deinit(q);
+	if (proto)
+		proto_ops.deinit(proto);
+	if (lcd.hndl)
+		lcd.ops->deinit(lcd.hndl);
 
 	if (fd_server >= 0)
 		close(fd_server);
-	if (fd_client >= 0)
-		close(fd_client);
 
+	log_deinit();
 	return 0;
 }
 
+#ifdef __NuttX__
 /* NuttX entry point */
 int lcd_translator_main(int argc, char *argv[])
 {
@@ -165,79 +433,138 @@ int lcd_translator_main(int argc, char *argv[])
 	cfg.server_port = "/dev/ttyACM0";
 	cfg.client_port = "/dev/slcd0";
 	int fd_server = -1;
-	struct mtxorb_hndl *mtxorb;
-	struct proto_cmd_ops mtxorb_ops;
-	struct ctrl_slcd *slcd = NULL;
+	void *proto = NULL;
+	struct proto_cmd_ops proto_ops;
+	struct ctrl lcd = { 0 };
+	struct compositor *comp = NULL;
+	struct cmdq *q = NULL;
+	static struct charset cs;
+	static struct input in;
+	struct server_init srv = { .cfg = &cfg };
+	pthread_t srv_thread;
+	int srv_threaded = 0;
+	uint8_t nrows, ncolumns;
+	uint32_t start;
+	int timeout = -1;
+	int i, ret;
+
+	for (i = 0; i < COMP_MAX_CLIENTS; i++)
+		srv.fd[i] = -1;
 
 	if (argc > 1)
 		cfg.server_port = argv[1];
 	if (argc > 2)
 		cfg.client_port = argv[2];
+	if (argc > 3)
+		cfg.charset = argv[3];
 
-	//printf("Hello\n");
-	sleep(1);
-	if (init_server(&fd_server, &cfg) < 0) {
-		error("init_server fail\n");
+	log_init(1);
+	start = time_ms();
+
+	charset_init(&cs, CHARSET_DEFAULT);
+	if (cfg.charset && charset_parse(&cs, cfg.charset) < 0)
+		error("bad charset %s, using the default one\n", cfg.charset);
+
+	if (cfg_parse_servers(&cfg) < 0) {
+		error("bad server ports: %s\n", cfg.server_port);
 		goto exit_init;
 	}
-	printf("init_server ok\n");
-	sleep(1);
-	if (!(slcd = ctrl_slcd_init(cfg.client_port))) {
-		error("ctrl_slcd_init fail\n");
+
+	/* The server port might still be enumerating: wait for it in
+	 * background while the display gets initialized. */
+	srv_threaded = !pthread_create(&srv_thread, NULL, init_server_thread, &srv);
+	if (!srv_threaded)
+		init_server_thread(&srv);
+
+	if (ctrl_open(&lcd, cfg.client_port, &cs) < 0)
+		goto exit_init;
+	info("display init ok (%u ms)\n", time_ms() - start);
+	if (cfg.nservers > 1) {
+		if (!(comp = init_compositor(&cfg, &lcd))) {
+			error("compositor init fail\n");
+			goto exit_init;
+		}
+		info("compositor ok, %d clients\n", cfg.nservers);
+	} else if (proto_init(cfg.server_protos[0], &proto, &proto_ops) < 0) {
+		error("proto_init fail\n");
+		goto exit_init;
+	} else {
+		info("proto_init ok\n");
+		lcd.ops->geometry(lcd.hndl, &nrows, &ncolumns);
+		q = cmdq_init(nrows, ncolumns);
+		if (!q) {
+			error("cmdq_init fail\n");
+			goto exit_init;
+		}
+		input_init(&in, proto, &proto_ops, q, &lcd);
+	}
+
+	if (srv_threaded) {
+		pthread_join(srv_thread, NULL);
+		srv_threaded = 0;
+	}
+	if (srv.ret < 0) {
+		error("init_server fail\n");
 		goto exit_init;
 	}
-	printf("ctrl_slcd_init ok\n");
-	sleep(1);
-	if (proto_mtxorb_init(&mtxorb, &mtxorb_ops) < 0) {
-		error("proto_mtxorb_init fail\n");
+	fd_server = srv.fd[0];
+	info("init_server ok (%u ms)\n", srv.ready_ms - start);
+	info("ready in %u ms\n", time_ms() - start);
+
+	if (comp) {
+		run_compositor(&srv, comp, &lcd);
 		goto exit_init;
 	}
-	printf("proto_mtxorb_init ok\n");
-	sleep(1);
+
 	while (1) {
-		char c;
+		struct pollfd pfd = { .fd = fd_server, .events = POLLIN };
 		int rret;
-		struct proto_cmd_data cdata;
-		/* Assume to have a blocking read */
-		rret = read(fd_server, &c , 1);
-		if (rret < 0) {
-			if (errno == EINTR) {
-				break;
-			}
-			error("read error: %d\n", -errno);
-			usleep(200*1000);
+
+		/* Wake up only for input, or to retry a pending redraw */
+		rret = poll(&pfd, 1, timeout);
+		if (!rret) {
+			timeout = input_flush(&in);
 			continue;
 		}
-		if (!rret) {
-			info("eof\n");
+		rret = rret > 0 ? input_read(&in, fd_server) : -errno;
+		if (rret == -EINTR)
 			break;
+		if (!rret || (rret < 0 && server_lost(-rret))) {
+			input_apply(&in);
+			ret = reconnect_server(&fd_server, cfg.server_ports[0],
+					       &lcd);
+			srv.fd[0] = fd_server;
+			if (ret < 0)
+				break;
+			continue;
 		}
-
-#if 0
-		printf("0x%02x\n", (unsigned char)c);
-#endif
-		rret = mtxorb_ops.parse_cmd(mtxorb, c, &cdata);
-		if (rret == 1) {
-			ctrl_slcd_cmd(slcd, &cdata);
-		} else if (rret < 0) {
-			error("parse_fail, byte: 0x%02x\n", c);
+		if (rret < 0) {
+			error("read error: %d\n", rret);
+			usleep(200*1000);
+			continue;
 		}
-
-#if 0
-		if (isprint(c) || c == 0xa)
-			printf("%c", (unsigned char)c);
-		else
-			printf("\n0x%02x\n", (unsigned char)c);
-#endif
-
+		input_process(&in, fd_server, &timeout);
 	};
 
 exit_init:
-	proto_mtxorb_deinit(mtxorb);
-	ctrl_slcd_deinit(slcd);
-	if (fd_server >= 0)
-		close(fd_server);
+	if (srv_threaded)
+		pthread_join(srv_thread, NULL);
+	compositor_deinit(comp);
+	cmdq_deinit(q);
+	if (proto)
+		proto_ops.deinit(proto);
+	if (lcd.hndl)
+		lcd.ops->deinit(lcd.hndl);
+	for (i = 0; i < COMP_MAX_CLIENTS; i++) {
+		if (srv.fd[i] >= 0)
+			close(srv.fd[i]);
+	}
+	/* The builtin runs again in the same address space */
+	free(cfg.server_list);
+	cfg.server_list = NULL;
 
+	log_deinit();
 	return 0;
 
 }
+#endif /* __NuttX__ */
@@ -0,0 +1,445 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Time the mtxorb parser alone, byte by byte (parse_cmd) and buffered
+ * (parse_cmd_buffered), over typical and adversarial inputs, to compare
+ * changes to msg_fsm_run() and the opcode table.
+ *
+ * parserbench [-i <input>[,...]] [-n bytes] [-t ms] [-s seed]
+ *
+ * -i: inputs to run (default all)
+ *     text    printable chars only
+ *     frame   lcdproc like rows: cursor position and a whole row of text
+ *     cursor  dense cursor moves, cursor modes and single chars
+ *     cgram   custom char uploads
+ *     random  uniform random bytes, unknown opcodes included
+ * -n: input length (default 65536)
+ * -t: each case is repeated for at least that long (default 200)
+ *
+ * Branch and cache misses are read with perf_event_open() when the kernel
+ * allows it (perf_event_paranoid). The figures are only worth comparing
+ * with an optimised build:
+ *   make -f makefile.linux CFLAGS="-I. -O2" bench-parser
+ */
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "proto.h"
+#include "utils.h"
+
+#define BENCH_NROWS 4
+#define BENCH_NCOLUMNS 20
+
+enum bench_input {
+	BENCH_TEXT,
+	BENCH_FRAME,
+	BENCH_CURSOR,
+	BENCH_CGRAM,
+	BENCH_RANDOM,
+	BENCH_NINPUT,
+};
+
+static const char *bench_input_str[BENCH_NINPUT] = {
+	[BENCH_TEXT] = "text",
+	[BENCH_FRAME] = "frame",
+	[BENCH_CURSOR] = "cursor",
+	[BENCH_CGRAM] = "cgram",
+	[BENCH_RANDOM] = "random",
+};
+
+enum bench_counter {
+	BENCH_INSTRUCTIONS,
+	BENCH_BRANCH_MISSES,
+	BENCH_CACHE_MISSES,
+	BENCH_NCOUNTER,
+};
+
+static const uint64_t bench_counter_cfg[BENCH_NCOUNTER] = {
+	[BENCH_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+	[BENCH_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+	[BENCH_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+};
+
+struct bench_result {
+	uint64_t bytes;
+	uint64_t cmds;
+	uint64_t us;
+	/* -1 when the counter is not available */
+	int64_t count[BENCH_NCOUNTER];
+};
+
+/* -1 for the counters that can't be opened */
+static int bench_fd[BENCH_NCOUNTER];
+/* Keeps the parsed commands alive */
+static volatile uint32_t bench_sink;
+
+static void bench_counters_init(void)
+{
+	struct perf_event_attr attr;
+	int i, err = 0;
+
+	for (i = 0; i < BENCH_NCOUNTER; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = bench_counter_cfg[i];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		bench_fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (bench_fd[i] < 0)
+			err = errno;
+	}
+	if (err)
+		fprintf(stderr, "perf counters not all available: %s\n",
+			strerror(err));
+}
+
+static void bench_counters_deinit(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_NCOUNTER; i++) {
+		if (bench_fd[i] >= 0)
+			close(bench_fd[i]);
+	}
+}
+
+static void bench_counters_start(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_NCOUNTER; i++) {
+		if (bench_fd[i] < 0)
+			continue;
+		ioctl(bench_fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static void bench_counters_stop(struct bench_result *res)
+{
+	uint64_t v;
+	int i;
+
+	for (i = 0; i < BENCH_NCOUNTER; i++) {
+		res->count[i] = -1;
+		if (bench_fd[i] < 0)
+			continue;
+		ioctl(bench_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(bench_fd[i], &v, sizeof(v)) == sizeof(v))
+			res->count[i] = v;
+	}
+}
+
+/* Append d to buf, return the new length or len if it does not fit */
+static int bench_put(uint8_t *buf, int len, int size,
+		     const struct proto_cmd_data *d)
+{
+	int ret = proto_mtxorb_encode(d, &buf[len], size - len);
+
+	return ret < 0 ? len : len + ret;
+}
+
+static uint8_t bench_printable(void)
+{
+	return ' ' + rand() % ('~' - ' ' + 1);
+}
+
+static void bench_text(uint8_t *buf, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = bench_printable();
+}
+
+static int bench_frame(uint8_t *buf, int size)
+{
+	struct proto_cmd_data d = { .cmd = PROTO_CMD_TEXT };
+	int len = 0, prev, r = 0, c;
+
+	do {
+		prev = len;
+		d.data.text.row = r + 1;
+		d.data.text.col = 1;
+		d.data.text.len = BENCH_NCOLUMNS;
+		for (c = 0; c < BENCH_NCOLUMNS; c++)
+			d.data.text.buf[c] = bench_printable();
+		len = bench_put(buf, len, size, &d);
+		r = (r + 1) % BENCH_NROWS;
+	} while (len != prev);
+	return len;
+}
+
+static int bench_cursor(uint8_t *buf, int size)
+{
+	static const enum proto_cmds moves[] = {
+		PROTO_CMD_SEND_CURSOR_HOME,
+		PROTO_CMD_CURSOR_LEFT,
+		PROTO_CMD_CURSOR_RIGHT,
+		PROTO_CMD_UNDERLINE_CURSOR_ON,
+		PROTO_CMD_UNDERLINE_CURSOR_OFF,
+		PROTO_CMD_BLINK_CURSOR_ON,
+		PROTO_CMD_BLINK_CURSOR_OFF,
+	};
+	struct proto_cmd_data d;
+	int len = 0, prev;
+
+	do {
+		prev = len;
+		if (rand() % 2) {
+			d.cmd = PROTO_CMD_SET_CURSOR_POS;
+			d.data.pos.col = 1 + rand() % BENCH_NCOLUMNS;
+			d.data.pos.row = 1 + rand() % BENCH_NROWS;
+		} else {
+			d.cmd = moves[rand() % (sizeof(moves) / sizeof(moves[0]))];
+		}
+		len = bench_put(buf, len, size, &d);
+		if (len != prev && len < size)
+			buf[len++] = bench_printable();
+	} while (len != prev);
+	return len;
+}
+
+static int bench_cgram(uint8_t *buf, int size)
+{
+	struct proto_cmd_data d = { .cmd = PROTO_CMD_ADD_CUSTOM_CHAR };
+	int len = 0, prev, i;
+
+	do {
+		prev = len;
+		d.data.custom_char.idx = rand() % 8;
+		for (i = 0; i < 8; i++)
+			d.data.custom_char.bmp[i] = rand() & 0x1f;
+		len = bench_put(buf, len, size, &d);
+	} while (len != prev);
+	return len;
+}
+
+static int bench_random(uint8_t *buf, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = rand();
+	return size;
+}
+
+static int bench_fill(enum bench_input in, uint8_t *buf, int size)
+{
+	switch (in) {
+	case BENCH_TEXT:
+		bench_text(buf, size);
+		return size;
+	case BENCH_FRAME:
+		return bench_frame(buf, size);
+	case BENCH_CURSOR:
+		return bench_cursor(buf, size);
+	case BENCH_CGRAM:
+		return bench_cgram(buf, size);
+	default:
+		return bench_random(buf, size);
+	}
+}
+
+static uint64_t bench_pass_byte(void *h, const struct proto_cmd_ops *ops,
+				const uint8_t *buf, int len)
+{
+	struct proto_cmd_data d;
+	uint64_t cmds = 0;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (ops->parse_cmd(h, buf[i], &d) == 1) {
+			bench_sink += d.cmd;
+			cmds++;
+		}
+	}
+	return cmds;
+}
+
+/* ring is twice the size of the input, as read() leaves it: no wrap */
+static uint64_t bench_pass_buffered(void *h, const struct proto_cmd_ops *ops,
+				    char *ring, int ring_size, int len)
+{
+	struct circ_buf cb = { .buf = ring, .head = len, .tail = 0 };
+	struct proto_cmd_data d;
+	uint64_t cmds = 0;
+	int ret;
+
+	while ((ret = ops->parse_cmd_buffered(h, &cb, ring_size, &d))) {
+		if (ret == 1) {
+			bench_sink += d.cmd;
+			cmds++;
+		}
+	}
+	return cmds;
+}
+
+static void bench_run(const uint8_t *buf, int len, char *ring, int ring_size,
+		      int buffered, uint32_t min_ms, struct bench_result *res)
+{
+	struct proto_cmd_ops ops;
+	struct mtxorb_hndl *h;
+	uint64_t start, min_us = (uint64_t)min_ms * 1000;
+
+	memset(res, 0, sizeof(*res));
+	if (proto_mtxorb_init(&h, &ops) < 0)
+		return;
+	if (buffered)
+		memcpy(ring, buf, len);
+
+	/* Warm up caches and branch predictors */
+	if (buffered)
+		bench_pass_buffered(h, &ops, ring, ring_size, len);
+	else
+		bench_pass_byte(h, &ops, buf, len);
+
+	bench_counters_start();
+	start = time_us();
+	do {
+		if (buffered)
+			res->cmds += bench_pass_buffered(h, &ops, ring,
+							 ring_size, len);
+		else
+			res->cmds += bench_pass_byte(h, &ops, buf, len);
+		res->bytes += len;
+		res->us = time_us() - start;
+	} while (res->us < min_us);
+	bench_counters_stop(res);
+
+	proto_mtxorb_deinit(h);
+}
+
+static void bench_print(const char *input, const char *api,
+			const struct bench_result *res)
+{
+	double kb = res->bytes / 1024.0;
+	int i;
+
+	printf("%-7s %-8s %8.2f %9.2f", input, api,
+	       res->us * 1000.0 / res->bytes,
+	       res->us ? res->cmds / (double)res->us : 0);
+	/* Instructions per byte, misses per kB */
+	for (i = 0; i < BENCH_NCOUNTER; i++) {
+		if (res->count[i] < 0)
+			printf(" %*s", i ? 10 : 6, "-");
+		else if (i == BENCH_INSTRUCTIONS)
+			printf(" %6.2f", (double)res->count[i] / res->bytes);
+		else
+			printf(" %10.2f", res->count[i] / kb);
+	}
+	printf("\n");
+}
+
+static int bench_inputs(const char *list, uint32_t *mask)
+{
+	char *s = strdup(list), *tok, *save;
+	int i, ret = 0;
+
+	*mask = 0;
+	for (tok = strtok_r(s, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < BENCH_NINPUT; i++) {
+			if (!strcmp(tok, bench_input_str[i]))
+				break;
+		}
+		if (i == BENCH_NINPUT) {
+			fprintf(stderr, "unknown input %s\n", tok);
+			ret = -EINVAL;
+			break;
+		}
+		*mask |= 1 << i;
+	}
+	free(s);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t mask = (1 << BENCH_NINPUT) - 1, min_ms = 200;
+	unsigned int seed = 1;
+	int size = 65536, ring_size, opt, i, len;
+	struct bench_result res;
+	uint8_t *buf;
+	char *ring;
+
+	while ((opt = getopt(argc, argv, "i:n:t:s:")) != -1) {
+		switch (opt) {
+		case 'i':
+			if (bench_inputs(optarg, &mask) < 0)
+				return 1;
+			break;
+		case 'n':
+			size = atoi(optarg);
+			break;
+		case 't':
+			min_ms = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i <input>[,...]] [-n bytes] "
+				"[-t ms] [-s seed]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (size < 64) {
+		fprintf(stderr, "input length too small\n");
+		return 1;
+	}
+
+	/* Power of 2 with room for the whole input */
+	for (ring_size = 1; ring_size <= size; ring_size <<= 1)
+		;
+	buf = malloc(size);
+	ring = malloc(ring_size);
+	if (!buf || !ring)
+		return 1;
+	bench_counters_init();
+
+	printf("%d bytes per pass, at least %u ms per case\n", size, min_ms);
+	printf("%-7s %-8s %8s %9s %6s %10s %10s\n", "input", "api", "ns/byte",
+	       "Mcmd/s", "insn/B", "brmiss/kB", "cmiss/kB");
+	for (i = 0; i < BENCH_NINPUT; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		srand(seed);
+		len = bench_fill(i, buf, size);
+		bench_run(buf, len, ring, ring_size, 0, min_ms, &res);
+		bench_print(bench_input_str[i], "byte", &res);
+		bench_run(buf, len, ring, ring_size, 1, min_ms, &res);
+		bench_print(bench_input_str[i], "buffered", &res);
+	}
+
+	bench_counters_deinit();
+	free(ring);
+	free(buf);
+	return 0;
+}
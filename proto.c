@@ -17,11 +17,13 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include "proto.h"
 
 const char * proto_cmds_str[PROTO_CMD_LAST] = {
 	[PROTO_CMD_INVALID] = "invalid",
 	[PROTO_CMD_ASCII] = "ascii",
+	[PROTO_CMD_TEXT] = "text",
 	[PROTO_CMD_GET_SN] = "get_sn",
 	[PROTO_CMD_GET_FW_VER] = "get_fw_ver",
 	[PROTO_CMD_GET_DISPLAY_TYPE] = "get_display_type",
@@ -37,10 +39,42 @@ const char * proto_cmds_str[PROTO_CMD_LAST] = {
 	[PROTO_CMD_BLINK_CURSOR_OFF] = "blink_cursor_off",
 	[PROTO_CMD_CURSOR_LEFT] = "cursor_left",
 	[PROTO_CMD_CURSOR_RIGHT] = "cursor_right",
+	[PROTO_CMD_INIT_HBAR] = "init_hbar",
+	[PROTO_CMD_INIT_VBAR_WIDE] = "init_vbar_wide",
+	[PROTO_CMD_INIT_VBAR_NARROW] = "init_vbar_narrow",
+	[PROTO_CMD_PLACE_HBAR] = "place_hbar",
+	[PROTO_CMD_PLACE_VBAR] = "place_vbar",
+	[PROTO_CMD_INIT_BIG_NUM] = "init_big_num",
+	[PROTO_CMD_PLACE_BIG_NUM] = "place_big_num",
 	[PROTO_CMD_ADD_CUSTOM_CHAR] = "add_custom_char",
 	[PROTO_CMD_CLR_DISPLAY] = "clr_display",
 	[PROTO_CMD_SET_CONTRAST] = "set_contrast",
 	[PROTO_CMD_BACKLIGHT_ON] = "backlight_on",
 	[PROTO_CMD_BACKLIGHT_OFF] = "backlight_off",
 	[PROTO_CMD_BACKLIGHT_LVL] = "backlight_lvl",
+	[PROTO_CMD_GPO_OFF] = "gpo_off",
+	[PROTO_CMD_GPO_ON] = "gpo_on",
 };
+
+#define PROTO_CFA_PREFIX "cfa:"
+
+char *proto_port(char *spec, enum proto_type *type)
+{
+	if (!strncmp(spec, PROTO_CFA_PREFIX, strlen(PROTO_CFA_PREFIX))) {
+		*type = PROTO_CFA;
+		return spec + strlen(PROTO_CFA_PREFIX);
+	}
+	*type = PROTO_MTXORB;
+	return spec;
+}
+
+int proto_init(enum proto_type type, void **hndl, struct proto_cmd_ops *ops)
+{
+	switch (type) {
+	case PROTO_CFA:
+		return proto_cfa_init((struct cfa_hndl **)hndl, ops);
+	case PROTO_MTXORB:
+	default:
+		return proto_mtxorb_init((struct mtxorb_hndl **)hndl, ops);
+	}
+}
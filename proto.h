@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 enum proto_cmds {
 	PROTO_CMD_INVALID,
 	PROTO_CMD_ASCII,
+	PROTO_CMD_TEXT, /* data */
 	/* This list have been created by referring to mtxorb datasheet,
 	 * however it should be generic.
 	 */
@@ -44,7 +45,15 @@ enum proto_cmds {
 	PROTO_CMD_BLINK_CURSOR_OFF,
 	PROTO_CMD_CURSOR_LEFT,
 	PROTO_CMD_CURSOR_RIGHT,
-	/* skip graphics / bars / etc... */
+	/* skip graphics */
+	/* Bars and big numbers are rendered locally with custom chars */
+	PROTO_CMD_INIT_HBAR,
+	PROTO_CMD_INIT_VBAR_WIDE,
+	PROTO_CMD_INIT_VBAR_NARROW,
+	PROTO_CMD_PLACE_HBAR, /* data */
+	PROTO_CMD_PLACE_VBAR, /* data */
+	PROTO_CMD_INIT_BIG_NUM,
+	PROTO_CMD_PLACE_BIG_NUM, /* data */
 	PROTO_CMD_ADD_CUSTOM_CHAR,
 	PROTO_CMD_CLR_DISPLAY,
 	PROTO_CMD_SET_CONTRAST, /* data */
@@ -65,18 +74,45 @@ struct proto_pos {
 	uint8_t row;
 };
 
+/* A whole row on the widest display */
+#define PROTO_TEXT_MAX 40
+
+/* A run of ascii chars. Position is one based, 0 means at the cursor */
+struct proto_text {
+	uint8_t row;
+	uint8_t col;
+	uint8_t len;
+	uint8_t buf[PROTO_TEXT_MAX];
+};
+
 struct proto_custom_char {
 	uint8_t idx;
 	uint8_t bmp[8];
 };
 
+/* Positions are one based, length is in pixels */
+struct proto_bar {
+	uint8_t col;
+	uint8_t row; /* unused by vertical bars */
+	uint8_t dir; /* 0: right, 1: left. Unused by vertical bars */
+	uint8_t len;
+};
+
+struct proto_big_num {
+	uint8_t col;
+	uint8_t digit;
+};
+
 struct proto_cmd_data {
 	enum proto_cmds cmd;
 	union cmd_data {
 		struct proto_pos pos;
 		uint8_t contrast;
 		uint8_t ascii;
+		struct proto_text text;
 		struct proto_custom_char custom_char;
+		struct proto_bar bar;
+		struct proto_big_num big_num;
 	} data;
 };
 
@@ -89,13 +125,45 @@ struct proto_cmd_ops {
 	 * -1: no valid command
 	 *  0: partial / incomplete command
 	 *  1: valid command parsed
+	 *
+	 * The buffered variant returns 0 once the buffer is empty, text is
+	 * returned in runs (PROTO_CMD_TEXT) instead of one char at time.
 	 */
 	int (*parse_cmd_buffered)(void *hndl, struct circ_buf *buf, int buf_size, struct proto_cmd_data *d);
 	int (*parse_cmd)(void *hndl, uint8_t c, struct proto_cmd_data *d);
+	/* Bytes for the client (acknowledges), NULL when the protocol sends
+	 * none. Return their length, 0 once there is nothing left. */
+	int (*reply)(void *hndl, uint8_t *buf, int size);
+	int (*deinit)(void *hndl);
 };
 
+enum proto_type {
+	PROTO_MTXORB,
+	PROTO_CFA,
+};
+
+/* Server port given as [cfa:]<port>: Crystalfontz packets with the
+ * "cfa:" prefix, Matrix Orbital otherwise. Return the port name. */
+char *proto_port(char *spec, enum proto_type *type);
+int proto_init(enum proto_type type, void **hndl, struct proto_cmd_ops *ops);
+
 struct mtxorb_hndl;
 int proto_mtxorb_init(struct mtxorb_hndl **hndl, struct proto_cmd_ops *ops);
 int proto_mtxorb_deinit(struct mtxorb_hndl *hndl);
+/* The bytes a mtxorb client sends for d, as the parser reads them back.
+ * Text with a position is preceded by a cursor position command.
+ * Return the length, -EINVAL if d has no mtxorb encoding or -ENOSPC.
+ */
+int proto_mtxorb_encode(const struct proto_cmd_data *d, uint8_t *buf, int size);
+
+struct cfa_hndl;
+int proto_cfa_init(struct cfa_hndl **hndl, struct proto_cmd_ops *ops);
+int proto_cfa_deinit(struct cfa_hndl *hndl);
+/* CRC-16 of the packets: polynomial 0x8408 (reflected), 0xffff seed,
+ * complemented */
+uint16_t proto_cfa_crc(const uint8_t *buf, int len);
+/* Build a packet with its crc. Return its length or a negative errno */
+int proto_cfa_packet(uint8_t type, const uint8_t *data, int len, uint8_t *buf,
+		     int size);
 
 #endif //PROTO_H
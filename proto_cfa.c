@@ -0,0 +1,358 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Crystalfontz packet protocol (CFA533/631/633/635): every packet is
+ *
+ *   type | length | data[length] | crc (LSB first)
+ *
+ * type is the command code in bits 5..0, bits 7..6 tell a command (0)
+ * from a normal (1) or error (3) response. The crc covers type, length
+ * and data. The module acknowledges every command.
+ *
+ * A packet that does not check is dropped one byte at a time, the next
+ * packet is found again as soon as it is complete.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proto.h"
+
+#define CFA_DATA_MAX 22
+#define CFA_PKT_MAX (2 + CFA_DATA_MAX + 2)
+#define CFA_CODE_MAX 35
+
+#define CFA_TYPE_CMD 0x00
+#define CFA_TYPE_RESPONSE 0x40
+#define CFA_TYPE_ERROR 0xc0
+#define CFA_TYPE_MASK 0xc0
+
+/* Acknowledges waiting to be sent: a few packets */
+#define CFA_REPLY_SIZE 64
+
+/* Command codes, named after the CFA635 datasheet */
+enum cfa_cmds {
+	CFA_PING = 0,
+	CFA_GET_VERSION = 1,
+	CFA_WRITE_FLASH = 2,
+	CFA_READ_FLASH = 3,
+	CFA_STORE_BOOT_STATE = 4,
+	CFA_REBOOT = 5,
+	CFA_CLEAR = 6,
+	CFA_SET_LINE1 = 7,
+	CFA_SET_LINE2 = 8,
+	CFA_SET_CUSTOM_CHAR = 9,
+	CFA_SET_CURSOR_POS = 11,
+	CFA_SET_CURSOR_STYLE = 12,
+	CFA_SET_CONTRAST = 13,
+	CFA_SET_BACKLIGHT = 14,
+	CFA_SEND_DATA = 31,
+};
+
+/* What a CFA633 answers, clients only show it */
+#define CFA_VERSION "CFA633:h1.5,k1.7"
+/* Line commands of the CFA633 carry a whole 16 chars row */
+#define CFA_LINE_LEN 16
+
+struct cfa_hndl {
+	uint8_t pkt[CFA_PKT_MAX];
+	int n;
+	/* Commands of the last packet not returned yet */
+	struct proto_cmd_data out[2];
+	int nout;
+	int iout;
+	uint8_t reply[CFA_REPLY_SIZE];
+	int nreply;
+};
+
+uint16_t proto_cfa_crc(const uint8_t *buf, int len)
+{
+	uint16_t crc = 0xffff;
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return ~crc;
+}
+
+int proto_cfa_packet(uint8_t type, const uint8_t *data, int len, uint8_t *buf,
+		     int size)
+{
+	uint16_t crc;
+
+	if (len > CFA_DATA_MAX)
+		return -EINVAL;
+	if (len + 4 > size)
+		return -ENOSPC;
+	buf[0] = type;
+	buf[1] = len;
+	memcpy(&buf[2], data, len);
+	crc = proto_cfa_crc(buf, len + 2);
+	buf[len + 2] = crc & 0xff;
+	buf[len + 3] = crc >> 8;
+	return len + 4;
+}
+
+static void cfa_reply(struct cfa_hndl *h, uint8_t type, const uint8_t *data,
+		      int len)
+{
+	int n = proto_cfa_packet(type, data, len, &h->reply[h->nreply],
+				 CFA_REPLY_SIZE - h->nreply);
+
+	/* Nobody reads them: the oldest are of no use anymore */
+	if (n == -ENOSPC) {
+		h->nreply = 0;
+		n = proto_cfa_packet(type, data, len, h->reply, CFA_REPLY_SIZE);
+	}
+	if (n > 0)
+		h->nreply += n;
+}
+
+static struct proto_cmd_data *cfa_out(struct cfa_hndl *h, enum proto_cmds cmd)
+{
+	struct proto_cmd_data *d = &h->out[h->nout++];
+
+	memset(d, 0, sizeof(*d));
+	d->cmd = cmd;
+	return d;
+}
+
+static void cfa_text(struct cfa_hndl *h, uint8_t row, uint8_t col,
+		     const uint8_t *buf, int len)
+{
+	struct proto_cmd_data *d = cfa_out(h, PROTO_CMD_TEXT);
+
+	if (len > PROTO_TEXT_MAX)
+		len = PROTO_TEXT_MAX;
+	d->data.text.row = row;
+	d->data.text.col = col;
+	d->data.text.len = len;
+	memcpy(d->data.text.buf, buf, len);
+}
+
+/* A packet that checked: commands for the display in h->out, and the
+ * acknowledge. Return 0 or -1 for a command not supported. */
+static int cfa_exec(struct cfa_hndl *h)
+{
+	uint8_t code = h->pkt[0] & ~CFA_TYPE_MASK, len = h->pkt[1];
+	const uint8_t *data = &h->pkt[2];
+	struct proto_cmd_data *d;
+	uint8_t flash[16] = { 0 };
+
+	h->nout = 0;
+	h->iout = 0;
+	switch (code) {
+	case CFA_PING:
+		cfa_reply(h, CFA_TYPE_RESPONSE | code, data, len);
+		return 0;
+	case CFA_GET_VERSION:
+		cfa_reply(h, CFA_TYPE_RESPONSE | code, (const uint8_t *)CFA_VERSION,
+			  strlen(CFA_VERSION));
+		return 0;
+	case CFA_READ_FLASH:
+		cfa_reply(h, CFA_TYPE_RESPONSE | code, flash, sizeof(flash));
+		return 0;
+	case CFA_WRITE_FLASH:
+	case CFA_STORE_BOOT_STATE:
+	case CFA_REBOOT:
+		/* Nothing to keep */
+		break;
+	case CFA_CLEAR:
+		cfa_out(h, PROTO_CMD_CLR_DISPLAY);
+		break;
+	case CFA_SET_LINE1:
+	case CFA_SET_LINE2:
+		cfa_text(h, code - CFA_SET_LINE1 + 1, 1, data,
+			 len < CFA_LINE_LEN ? len : CFA_LINE_LEN);
+		break;
+	case CFA_SET_CUSTOM_CHAR:
+		if (len < 9)
+			goto exit_error;
+		d = cfa_out(h, PROTO_CMD_ADD_CUSTOM_CHAR);
+		d->data.custom_char.idx = data[0];
+		memcpy(d->data.custom_char.bmp, &data[1], 8);
+		break;
+	case CFA_SET_CURSOR_POS:
+		if (len < 2)
+			goto exit_error;
+		d = cfa_out(h, PROTO_CMD_SET_CURSOR_POS);
+		d->data.pos.col = data[0] + 1;
+		d->data.pos.row = data[1] + 1;
+		break;
+	case CFA_SET_CURSOR_STYLE:
+		/* 0: none, 1: blinking block, 2: underscore, 3: both,
+		 * 4: inverting blinking underscore, shown as 3 */
+		if (len < 1 || data[0] > 4)
+			goto exit_error;
+		cfa_out(h, data[0] == 1 || data[0] >= 3 ?
+			PROTO_CMD_BLINK_CURSOR_ON : PROTO_CMD_BLINK_CURSOR_OFF);
+		cfa_out(h, data[0] >= 2 ? PROTO_CMD_UNDERLINE_CURSOR_ON :
+			PROTO_CMD_UNDERLINE_CURSOR_OFF);
+		break;
+	case CFA_SET_CONTRAST:
+		if (len < 1)
+			goto exit_error;
+		d = cfa_out(h, PROTO_CMD_SET_CONTRAST);
+		d->data.contrast = data[0];
+		break;
+	case CFA_SET_BACKLIGHT:
+		/* 0 to 100, the displays here can only switch it */
+		if (len < 1)
+			goto exit_error;
+		cfa_out(h, data[0] ? PROTO_CMD_BACKLIGHT_ON : PROTO_CMD_BACKLIGHT_OFF);
+		break;
+	case CFA_SEND_DATA:
+		/* col, row (zero based) and the text, one positioned run */
+		if (len < 3)
+			goto exit_error;
+		cfa_text(h, data[1] + 1, data[0] + 1, &data[2], len - 2);
+		break;
+	default:
+		goto exit_error;
+	}
+	cfa_reply(h, CFA_TYPE_RESPONSE | code, NULL, 0);
+	return 0;
+
+exit_error:
+	cfa_reply(h, CFA_TYPE_ERROR | code, NULL, 0);
+	return -1;
+}
+
+/* Find a packet at the start of pkt, the bytes that cannot start one
+ * are dropped. Return 1 once a packet is complete and checks, 0 when more
+ * bytes are needed. *bad is set if a complete one did not check. */
+static int cfa_sync(struct cfa_hndl *h, int *bad)
+{
+	uint16_t crc;
+	int len;
+
+	while (h->n) {
+		len = h->n >= 2 ? h->pkt[1] : 0;
+		if ((h->pkt[0] & CFA_TYPE_MASK) != CFA_TYPE_CMD ||
+		    (h->pkt[0] & ~CFA_TYPE_MASK) > CFA_CODE_MAX ||
+		    len > CFA_DATA_MAX) {
+			/* Not the start of a packet */
+		} else if (h->n < len + 4) {
+			return 0;
+		} else {
+			crc = proto_cfa_crc(h->pkt, len + 2);
+			if (h->pkt[len + 2] == (crc & 0xff) &&
+			    h->pkt[len + 3] == crc >> 8)
+				return 1;
+			*bad = 1;
+		}
+		/* Look for a packet from the next byte on */
+		memmove(h->pkt, &h->pkt[1], --h->n);
+	}
+	return 0;
+}
+
+/* Execute the packet found by cfa_sync() and drop it, the bytes after it
+ * are the start of the next one. */
+static int cfa_next(struct cfa_hndl *h)
+{
+	int ret = cfa_exec(h), len = h->pkt[1] + 4;
+
+	h->n -= len;
+	memmove(h->pkt, &h->pkt[len], h->n);
+	return ret;
+}
+
+static int cfa_parse_cmd_buffered(void *hndl, struct circ_buf *b, int b_size,
+				  struct proto_cmd_data *d)
+{
+	struct cfa_hndl *h = hndl;
+	int bad = 0;
+
+	while (h->iout == h->nout) {
+		if (cfa_sync(h, &bad)) {
+			if (cfa_next(h) < 0)
+				return -1;
+			continue;
+		}
+		if (bad)
+			return -1;
+		if (!CIRC_CNT(b->head, b->tail, b_size))
+			return 0;
+		h->pkt[h->n++] = b->buf[b->tail];
+		b->tail = (b->tail + 1) & (b_size - 1);
+	}
+	*d = h->out[h->iout++];
+	return 1;
+}
+
+static int cfa_parse_cmd(void *hndl, uint8_t c, struct proto_cmd_data *d)
+{
+	struct cfa_hndl *h = hndl;
+	int bad = 0;
+
+	h->pkt[h->n++] = c;
+	/* The second command of the previous packet goes first: a packet is
+	 * 4 bytes at least, c cannot complete another one yet */
+	if (h->iout == h->nout) {
+		if (cfa_sync(h, &bad) && cfa_next(h) < 0)
+			return -1;
+		if (bad)
+			return -1;
+	}
+	if (h->iout == h->nout)
+		return 0;
+	*d = h->out[h->iout++];
+	return 1;
+}
+
+static int cfa_reply_ops(void *hndl, uint8_t *buf, int size)
+{
+	struct cfa_hndl *h = hndl;
+	int n = h->nreply < size ? h->nreply : size;
+
+	memcpy(buf, h->reply, n);
+	h->nreply -= n;
+	memmove(h->reply, &h->reply[n], h->nreply);
+	return n;
+}
+
+static int cfa_deinit(void *hndl)
+{
+	return proto_cfa_deinit(hndl);
+}
+
+int proto_cfa_init(struct cfa_hndl **hndl, struct proto_cmd_ops *ops)
+{
+	*hndl = calloc(1, sizeof(struct cfa_hndl));
+	if (!*hndl)
+		return -1;
+
+	ops->parse_cmd = cfa_parse_cmd;
+	ops->parse_cmd_buffered = cfa_parse_cmd_buffered;
+	ops->reply = cfa_reply_ops;
+	ops->deinit = cfa_deinit;
+	return 0;
+}
+
+int proto_cfa_deinit(struct cfa_hndl *hndl)
+{
+	if (hndl)
+		free(hndl);
+	return 0;
+}
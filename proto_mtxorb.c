@@ -17,12 +17,15 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include "proto.h"
 
 #define MTXORB_HEADER 0xfe
+/* Longest command argument (custom char definition) */
+#define MTXORB_DATA_MAX 9
 
 enum msg_fsm_states {
 	MSG_FSM_NONE,
@@ -57,6 +60,13 @@ static const uint8_t mtxorb_cmds[PROTO_CMD_LAST+1] = {
 	[PROTO_CMD_BLINK_CURSOR_OFF] = 0x54,
 	[PROTO_CMD_CURSOR_LEFT] = 0x4c,
 	[PROTO_CMD_CURSOR_RIGHT] = 0x4d,
+	[PROTO_CMD_INIT_HBAR] = 0x68,
+	[PROTO_CMD_INIT_VBAR_WIDE] = 0x76,
+	[PROTO_CMD_INIT_VBAR_NARROW] = 0x73,
+	[PROTO_CMD_PLACE_HBAR] = 0x7c,
+	[PROTO_CMD_PLACE_VBAR] = 0x3d,
+	[PROTO_CMD_INIT_BIG_NUM] = 0x6e,
+	[PROTO_CMD_PLACE_BIG_NUM] = 0x23,
 	[PROTO_CMD_ADD_CUSTOM_CHAR] = 0x4e,
 	[PROTO_CMD_CLR_DISPLAY] = 0x58,
 	[PROTO_CMD_SET_CONTRAST] = 0x50,
@@ -80,11 +90,9 @@ static int msg_fsm_run(struct mtxorb_hndl *h, uint8_t c)
 		} else {
 			/* everything else can be considered ascii text (??) */
 			h->msg.cmd = PROTO_CMD_ASCII;
-			/* convert some chars... */
-			if (c == 0xff)
-				c = '#';
-
-			/* custom char: 0x00 to 0x07 */
+			/* Chars are translated for the display ROM by the
+			 * controller (see charset.c).
+			 * custom char: 0x00 to 0x07 */
 			h->msg.data.ascii = c;
 		}
 		break;
@@ -118,7 +126,18 @@ static int msg_fsm_run(struct mtxorb_hndl *h, uint8_t c)
 		}
 		if (h->msg.cmd == PROTO_CMD_ADD_CUSTOM_CHAR) {
 			h->msg_fsm = MSG_FSM_CMD;
-			h->msg_data_left = 9;
+			h->msg_data_left = MTXORB_DATA_MAX;
+			break;
+		}
+		if (h->msg.cmd == PROTO_CMD_PLACE_HBAR) {
+			h->msg_fsm = MSG_FSM_CMD;
+			h->msg_data_left = 4;
+			break;
+		}
+		if (h->msg.cmd == PROTO_CMD_PLACE_VBAR ||
+		    h->msg.cmd == PROTO_CMD_PLACE_BIG_NUM) {
+			h->msg_fsm = MSG_FSM_CMD;
+			h->msg_data_left = 2;
 			break;
 		}
 
@@ -140,11 +159,36 @@ static int msg_fsm_run(struct mtxorb_hndl *h, uint8_t c)
 			h->msg.data.contrast = c;
 		}
 		if (h->msg.cmd == PROTO_CMD_ADD_CUSTOM_CHAR) {
-			if (h->msg_data_left == 9)
+			if (h->msg_data_left == MTXORB_DATA_MAX)
 				h->msg.data.custom_char.idx = c;
 			else
 				h->msg.data.custom_char.bmp[8-h->msg_data_left] = c;
 		}
+		if (h->msg.cmd == PROTO_CMD_PLACE_HBAR) {
+			/* col, row, direction, length */
+			if (h->msg_data_left == 4)
+				h->msg.data.bar.col = c;
+			else if (h->msg_data_left == 3)
+				h->msg.data.bar.row = c;
+			else if (h->msg_data_left == 2)
+				h->msg.data.bar.dir = c;
+			else
+				h->msg.data.bar.len = c;
+		}
+		if (h->msg.cmd == PROTO_CMD_PLACE_VBAR) {
+			/* col, length */
+			if (h->msg_data_left == 2)
+				h->msg.data.bar.col = c;
+			else
+				h->msg.data.bar.len = c;
+		}
+		if (h->msg.cmd == PROTO_CMD_PLACE_BIG_NUM) {
+			/* col, digit */
+			if (h->msg_data_left == 2)
+				h->msg.data.big_num.col = c;
+			else
+				h->msg.data.big_num.digit = c;
+		}
 		/* Ignore backlight on data (minutes) */
 		/* Ignore backlight lvl data */
 		h->msg_data_left--;
@@ -159,24 +203,39 @@ static int msg_fsm_run(struct mtxorb_hndl *h, uint8_t c)
 static int mtxorb_parse_cmd_buffered(void *hndl, struct circ_buf *b, int b_size, struct proto_cmd_data *d)
 {
 	struct mtxorb_hndl *h = hndl;
+	const uint8_t *p, *hdr;
+	int n;
+
 	while (CIRC_CNT(b->head, b->tail, b_size) >= 1) {
-		uint8_t c = b->buf[b->tail];
+		p = (const uint8_t *)&b->buf[b->tail];
+		if (h->msg_fsm == MSG_FSM_NONE && *p != MTXORB_HEADER) {
+			/* Text up to the next command, taken at once */
+			n = CIRC_CNT_TO_END(b->head, b->tail, b_size);
+			if (n > PROTO_TEXT_MAX)
+				n = PROTO_TEXT_MAX;
+			hdr = memchr(p, MTXORB_HEADER, n);
+			if (hdr)
+				n = hdr - p;
+			d->cmd = PROTO_CMD_TEXT;
+			d->data.text.row = 0;
+			d->data.text.col = 0;
+			d->data.text.len = n;
+			memcpy(d->data.text.buf, p, n);
+			b->tail = ((b->tail + n) & (b_size - 1));
+			return 1;
+		}
+
 		b->tail = ((b->tail + 1) & (b_size - 1));
-		msg_fsm_run(h, c);
-		if (h->msg_fsm == MSG_FSM_NONE && h->msg.cmd != PROTO_CMD_INVALID) {
+		msg_fsm_run(h, *p);
+		if (h->msg_fsm == MSG_FSM_NONE) {
+			if (h->msg.cmd == PROTO_CMD_INVALID)
+				return -1;
 			*d = h->msg;
 			return 1;
 		}
-		/* On invalid command or incomplete message, continue to parse new bytes */
-	}
-
-	if (h->msg_fsm != MSG_FSM_NONE) {
-		if (h->msg.cmd == PROTO_CMD_INVALID)
-			return -1;
-		return 1;
+		/* On incomplete message, continue to parse new bytes */
 	}
 	return 0;
-
 }
 
 static int mtxorb_parse_cmd(void *hndl, uint8_t c, struct proto_cmd_data *d)
@@ -197,6 +256,93 @@ static int mtxorb_parse_cmd(void *hndl, uint8_t c, struct proto_cmd_data *d)
 
 }
 
+/* Bytes following the opcode, as msg_fsm_run() expects them */
+static int mtxorb_put_data(const struct proto_cmd_data *d, uint8_t *p)
+{
+	switch (d->cmd) {
+	case PROTO_CMD_SET_CURSOR_POS:
+		p[0] = d->data.pos.col;
+		p[1] = d->data.pos.row;
+		return 2;
+	case PROTO_CMD_SET_CONTRAST:
+		p[0] = d->data.contrast;
+		return 1;
+	case PROTO_CMD_BACKLIGHT_ON:
+		p[0] = 0; /* minutes, 0: stay on */
+		return 1;
+	case PROTO_CMD_BACKLIGHT_LVL:
+		p[0] = 0xff;
+		return 1;
+	case PROTO_CMD_ADD_CUSTOM_CHAR:
+		p[0] = d->data.custom_char.idx;
+		memcpy(&p[1], d->data.custom_char.bmp, 8);
+		return 9;
+	case PROTO_CMD_PLACE_HBAR:
+		p[0] = d->data.bar.col;
+		p[1] = d->data.bar.row;
+		p[2] = d->data.bar.dir;
+		p[3] = d->data.bar.len;
+		return 4;
+	case PROTO_CMD_PLACE_VBAR:
+		p[0] = d->data.bar.col;
+		p[1] = d->data.bar.len;
+		return 2;
+	case PROTO_CMD_PLACE_BIG_NUM:
+		p[0] = d->data.big_num.col;
+		p[1] = d->data.big_num.digit;
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+int proto_mtxorb_encode(const struct proto_cmd_data *d, uint8_t *buf, int size)
+{
+	uint8_t tmp[2 + MTXORB_DATA_MAX];
+	int len = 0;
+
+	switch (d->cmd) {
+	case PROTO_CMD_ASCII:
+		if (d->data.ascii == MTXORB_HEADER)
+			return -EINVAL;
+		if (size < 1)
+			return -ENOSPC;
+		buf[0] = d->data.ascii;
+		return 1;
+	case PROTO_CMD_TEXT:
+		if (d->data.text.len > PROTO_TEXT_MAX ||
+		    memchr(d->data.text.buf, MTXORB_HEADER, d->data.text.len))
+			return -EINVAL;
+		if (d->data.text.row && d->data.text.col) {
+			tmp[len++] = MTXORB_HEADER;
+			tmp[len++] = mtxorb_cmds[PROTO_CMD_SET_CURSOR_POS];
+			tmp[len++] = d->data.text.col;
+			tmp[len++] = d->data.text.row;
+		}
+		if (len + d->data.text.len > size)
+			return -ENOSPC;
+		memcpy(buf, tmp, len);
+		memcpy(&buf[len], d->data.text.buf, d->data.text.len);
+		return len + d->data.text.len;
+	default:
+		if (d->cmd <= PROTO_CMD_FIRST || d->cmd >= PROTO_CMD_LAST ||
+		    !mtxorb_cmds[d->cmd])
+			return -EINVAL;
+		tmp[len++] = MTXORB_HEADER;
+		tmp[len++] = mtxorb_cmds[d->cmd];
+		len += mtxorb_put_data(d, &tmp[len]);
+		if (len > size)
+			return -ENOSPC;
+		memcpy(buf, tmp, len);
+		return len;
+	}
+}
+
+static int mtxorb_deinit(void *hndl)
+{
+	return proto_mtxorb_deinit(hndl);
+}
+
 int proto_mtxorb_init(struct mtxorb_hndl **hndl, struct proto_cmd_ops *ops)
 {
 	struct mtxorb_hndl *p;
@@ -208,6 +354,10 @@ int proto_mtxorb_init(struct mtxorb_hndl **hndl, struct proto_cmd_ops *ops)
 	p = *hndl;
 
 	ops->parse_cmd = mtxorb_parse_cmd;
+	ops->parse_cmd_buffered = mtxorb_parse_cmd_buffered;
+	/* Queries are not answered */
+	ops->reply = NULL;
+	ops->deinit = mtxorb_deinit;
 	p->msg_fsm = MSG_FSM_NONE;
 	return 0;
 }
@@ -0,0 +1,153 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "screen.h"
+
+void screen_init(struct screen *s, uint8_t nrows, uint8_t ncolumns)
+{
+	memset(s, 0, sizeof(*s));
+	if (nrows > LCD_MAX_NROWS)
+		nrows = LCD_MAX_NROWS;
+	if (ncolumns > LCD_MAX_NCOLUMNS)
+		ncolumns = LCD_MAX_NCOLUMNS;
+	s->nrows = nrows;
+	s->ncolumns = ncolumns;
+	s->flags = SCREEN_F_WRAP;
+	screen_clear(s);
+}
+
+void screen_clear(struct screen *s)
+{
+	memset(s->cells, ' ', sizeof(s->cells));
+	s->row = 0;
+	s->col = 0;
+}
+
+static void screen_putc(struct screen *s, uint8_t c)
+{
+	s->cells[s->row][s->col] = c;
+	/* Line wrap is always done, like ctrl_slcd */
+	if (++s->col >= s->ncolumns) {
+		s->col = 0;
+		if (++s->row >= s->nrows)
+			s->row = 0;
+	}
+}
+
+static int screen_glyph_emit(void *ctx, const struct proto_cmd_data *cmd)
+{
+	return screen_apply(ctx, cmd);
+}
+
+int screen_apply(struct screen *s, const struct proto_cmd_data *cmd)
+{
+	uint8_t idx;
+
+	switch (cmd->cmd) {
+	case PROTO_CMD_ASCII:
+		screen_putc(s, cmd->data.ascii);
+		return 1;
+	case PROTO_CMD_TEXT:
+		/* Like ctrl_slcd, a bad position drops the whole text */
+		if (cmd->data.text.row || cmd->data.text.col) {
+			if (cmd->data.text.row < 1 || cmd->data.text.row > s->nrows ||
+			    cmd->data.text.col < 1 || cmd->data.text.col > s->ncolumns)
+				return 0;
+			s->row = cmd->data.text.row - 1;
+			s->col = cmd->data.text.col - 1;
+		}
+		for (idx = 0; idx < cmd->data.text.len; idx++)
+			screen_putc(s, cmd->data.text.buf[idx]);
+		return 1;
+	case PROTO_CMD_SET_CURSOR_POS:
+		/* One based, out of the display is ignored */
+		if (cmd->data.pos.row < 1 || cmd->data.pos.row > s->nrows ||
+		    cmd->data.pos.col < 1 || cmd->data.pos.col > s->ncolumns)
+			return 0;
+		s->row = cmd->data.pos.row - 1;
+		s->col = cmd->data.pos.col - 1;
+		return 1;
+	case PROTO_CMD_SEND_CURSOR_HOME:
+		s->row = 0;
+		s->col = 0;
+		return 1;
+	case PROTO_CMD_CURSOR_LEFT:
+		if (s->col > 0)
+			s->col--;
+		return 1;
+	case PROTO_CMD_CURSOR_RIGHT:
+		if (s->col < s->ncolumns - 1)
+			s->col++;
+		return 1;
+	case PROTO_CMD_CLR_DISPLAY:
+		screen_clear(s);
+		return 1;
+	case PROTO_CMD_ADD_CUSTOM_CHAR:
+		idx = cmd->data.custom_char.idx & (SCREEN_NGLYPHS - 1);
+		memcpy(s->glyphs[idx], cmd->data.custom_char.bmp, 8);
+		s->glyph_mask |= 1 << idx;
+		s->gs.set = GLYPH_SET_NONE;
+		return 1;
+	case PROTO_CMD_AUTO_LINE_WRAP_ON:
+		s->flags |= SCREEN_F_WRAP;
+		return 0;
+	case PROTO_CMD_AUTO_LINE_WRAP_OFF:
+		s->flags &= ~SCREEN_F_WRAP;
+		return 0;
+	case PROTO_CMD_AUTO_SCROLL_ON:
+		s->flags |= SCREEN_F_SCROLL;
+		return 0;
+	case PROTO_CMD_AUTO_SCROLL_OFF:
+		s->flags &= ~SCREEN_F_SCROLL;
+		return 0;
+	case PROTO_CMD_UNDERLINE_CURSOR_ON:
+		s->flags |= SCREEN_F_UNDERLINE;
+		return 1;
+	case PROTO_CMD_UNDERLINE_CURSOR_OFF:
+		s->flags &= ~SCREEN_F_UNDERLINE;
+		return 1;
+	case PROTO_CMD_BLINK_CURSOR_ON:
+		s->flags |= SCREEN_F_BLINK;
+		return 1;
+	case PROTO_CMD_BLINK_CURSOR_OFF:
+		s->flags &= ~SCREEN_F_BLINK;
+		return 1;
+	default:
+		if (glyph_is_cmd(cmd->cmd))
+			return glyph_render(&s->gs, cmd, s->nrows, s->ncolumns,
+					    screen_glyph_emit, s) > 0;
+		return 0;
+	}
+}
+
+int screen_shift(const struct screen *s, uint8_t r, uint8_t c,
+		 const uint8_t *text, int len)
+{
+	const uint8_t *old = &s->cells[r][c];
+
+	/* Same content, even if uniform like a blank row, is no shift */
+	if (len < 2 || !memcmp(old, text, len))
+		return 0;
+	if (!memcmp(old + 1, text, len - 1))
+		return 1;
+	if (!memcmp(old, text + 1, len - 1))
+		return -1;
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdint.h>
+#include "proto.h"
+#include "glyphs.h"
+#include "lcd_geometry.h"
+
+#define SCREEN_NGLYPHS 8
+
+enum screen_flags {
+	SCREEN_F_WRAP = 1 << 0,
+	SCREEN_F_SCROLL = 1 << 1,
+	SCREEN_F_UNDERLINE = 1 << 2,
+	SCREEN_F_BLINK = 1 << 3,
+};
+
+/* In-memory model of what a display shows. Rows and columns are zero
+ * based, custom chars are cells with values below SCREEN_NGLYPHS.
+ */
+struct screen {
+	uint8_t nrows;
+	uint8_t ncolumns;
+	/* cursor */
+	uint8_t row;
+	uint8_t col;
+	uint8_t flags;
+	/* Custom chars defined so far, one bit each */
+	uint8_t glyph_mask;
+	uint8_t cells[LCD_MAX_NROWS][LCD_MAX_NCOLUMNS];
+	uint8_t glyphs[SCREEN_NGLYPHS][8];
+	/* Used when bars and big numbers are applied to the screen */
+	struct glyph_state gs;
+};
+
+void screen_init(struct screen *s, uint8_t nrows, uint8_t ncolumns);
+void screen_clear(struct screen *s);
+
+/* Update the model as the display would do executing cmd.
+ * Return 1 if cells, cursor or custom chars changed, 0 otherwise.
+ */
+int screen_apply(struct screen *s, const struct proto_cmd_data *cmd);
+
+/* Compare text with what row r shows from column c on (c + len must fit
+ * in the row). Return 1 if it is the same content moved left by one
+ * column, -1 if moved right, 0 otherwise: what scrolling widgets send on
+ * each tick.
+ */
+int screen_shift(const struct screen *s, uint8_t r, uint8_t c,
+		 const uint8_t *text, int len);
+
+#endif /* SCREEN_H */
@@ -0,0 +1,200 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "utils.h"
+
+#if !defined(__NuttX__) || defined(CONFIG_FS_SHMFS)
+#  define SNAPSHOT_HAVE_SHM
+#endif
+
+#define SNAPSHOT_MAGIC 0x4c434453 /* LCDS */
+#define SNAPSHOT_READ_RETRY 16
+
+/* Seqlock protected double buffer.
+ * The publisher always writes the slot readers are not pointed to, then
+ * switches cur to it. A slot sequence is odd while the slot is being
+ * written: readers retry only if the publisher lapped them twice.
+ */
+struct snapshot_slot {
+	uint32_t seq;
+	struct lcd_snapshot snap;
+};
+
+struct snapshot_buf {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t cur;
+	struct snapshot_slot slot[2];
+};
+
+struct snapshot {
+	struct snapshot_buf *buf;
+	int shm;
+	const char *shm_name;
+	uint32_t frame;
+};
+
+static struct snapshot *snapshot_map(const char *shm_name, int publisher)
+{
+	struct snapshot *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->shm = -1;
+
+	if (!shm_name || !shm_name[0])
+		goto exit_private;
+
+#ifdef SNAPSHOT_HAVE_SHM
+	s->shm = shm_open(shm_name, publisher ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (s->shm < 0) {
+		error("snapshot: shm_open %s failed: %d\n", shm_name, -errno);
+		goto exit_shared;
+	}
+	if (publisher && ftruncate(s->shm, sizeof(*s->buf)) < 0) {
+		error("snapshot: ftruncate failed: %d\n", -errno);
+		goto exit_shm;
+	}
+	s->buf = mmap(NULL, sizeof(*s->buf),
+		      publisher ? PROT_READ | PROT_WRITE : PROT_READ,
+		      MAP_SHARED, s->shm, 0);
+	if (s->buf == MAP_FAILED) {
+		error("snapshot: mmap failed: %d\n", -errno);
+		goto exit_shm;
+	}
+	if (publisher) {
+		s->shm_name = shm_name;
+		memset(s->buf, 0, sizeof(*s->buf));
+		s->buf->size = sizeof(*s->buf);
+		__atomic_store_n(&s->buf->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+	} else if (__atomic_load_n(&s->buf->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_MAGIC ||
+		   s->buf->size != sizeof(*s->buf)) {
+		error("snapshot: %s is not a compatible snapshot\n", shm_name);
+		munmap(s->buf, sizeof(*s->buf));
+		goto exit_shm;
+	}
+	return s;
+
+exit_shm:
+	close(s->shm);
+	s->shm = -1;
+exit_shared:
+#else
+	error("snapshot: shared memory not supported\n");
+#endif
+	/* Shared memory is optional: the translator keeps its own copy */
+	if (publisher)
+		info("snapshot: not shared, private to this process\n");
+exit_private:
+	if (!publisher)
+		goto exit_alloc;
+	s->buf = calloc(1, sizeof(*s->buf));
+	if (!s->buf)
+		goto exit_alloc;
+	return s;
+
+exit_alloc:
+	free(s);
+	return NULL;
+}
+
+struct snapshot *snapshot_init(const char *shm_name)
+{
+	return snapshot_map(shm_name, 1);
+}
+
+struct snapshot *snapshot_open(const char *shm_name)
+{
+	return snapshot_map(shm_name, 0);
+}
+
+void snapshot_deinit(struct snapshot *s)
+{
+	if (!s)
+		return;
+#ifdef SNAPSHOT_HAVE_SHM
+	if (s->shm >= 0) {
+		munmap(s->buf, sizeof(*s->buf));
+		close(s->shm);
+		if (s->shm_name)
+			shm_unlink(s->shm_name);
+		free(s);
+		return;
+	}
+#endif
+	free(s->buf);
+	free(s);
+}
+
+void snapshot_publish(struct snapshot *s, const struct screen *scr)
+{
+	struct snapshot_buf *b = s->buf;
+	uint32_t i = b->cur ^ 1;
+	struct snapshot_slot *slot = &b->slot[i];
+	struct lcd_snapshot *snap = &slot->snap;
+
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snap->frame = ++s->frame;
+	snap->update_ms = time_ms();
+	snap->nrows = scr->nrows;
+	snap->ncolumns = scr->ncolumns;
+	snap->row = scr->row;
+	snap->col = scr->col;
+	snap->flags = scr->flags;
+	snap->glyph_mask = scr->glyph_mask;
+	memcpy(snap->cells, scr->cells, sizeof(snap->cells));
+	memcpy(snap->glyphs, scr->glyphs, sizeof(snap->glyphs));
+
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&b->cur, i, __ATOMIC_RELEASE);
+}
+
+int snapshot_read(struct snapshot *s, struct lcd_snapshot *out)
+{
+	struct snapshot_buf *b = s->buf;
+	int retry;
+
+	for (retry = 0; retry < SNAPSHOT_READ_RETRY; retry++) {
+		struct snapshot_slot *slot;
+		uint32_t seq;
+
+		slot = &b->slot[__atomic_load_n(&b->cur, __ATOMIC_ACQUIRE) & 1];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(out, &slot->snap, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	return -EAGAIN;
+}
@@ -0,0 +1,67 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "screen.h"
+
+#ifdef CONFIG_LCD_TRANSLATOR_SNAPSHOT_SHM
+#  define SNAPSHOT_SHM_NAME CONFIG_LCD_TRANSLATOR_SNAPSHOT_SHM
+#else
+#  define SNAPSHOT_SHM_NAME "/lcd_translator"
+#endif
+
+/* What the display is showing, as seen by monitoring tools */
+struct lcd_snapshot {
+	/* Incremented each time changes are published, once per display
+	 * flush */
+	uint32_t frame;
+	/* time_ms() of the last change, monotonic clock */
+	uint32_t update_ms;
+	uint8_t nrows;
+	uint8_t ncolumns;
+	uint8_t row;
+	uint8_t col;
+	uint8_t flags;
+	uint8_t glyph_mask;
+	uint8_t cells[LCD_MAX_NROWS][LCD_MAX_NCOLUMNS];
+	uint8_t glyphs[SCREEN_NGLYPHS][8];
+};
+
+struct snapshot;
+
+/* Publisher side. With a shm_name the snapshot is published in shared
+ * memory, otherwise, or when shared memory is not available, it is only
+ * visible to this process.
+ */
+struct snapshot *snapshot_init(const char *shm_name);
+void snapshot_deinit(struct snapshot *s);
+/* Never blocks, readers can't slow it down */
+void snapshot_publish(struct snapshot *s, const struct screen *scr);
+
+/* Reader side, for other processes */
+struct snapshot *snapshot_open(const char *shm_name);
+/* Get a consistent copy of the last published snapshot.
+ * Return 0 on success, -EAGAIN if the publisher kept overwriting it.
+ */
+int snapshot_read(struct snapshot *s, struct lcd_snapshot *out);
+
+#endif /* SNAPSHOT_H */
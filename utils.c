@@ -22,8 +22,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <termios.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #include "utils.h"
 
+/* Backoff used when no event source is available */
+#define DEV_POLL_MIN_MS 5
+#define DEV_POLL_MAX_MS 320
+
+uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t time_ms(void)
+{
+	return time_us() / 1000;
+}
+
 int tty_set_attribs(int fd, int speed)
 {
         struct termios tty;
@@ -61,3 +85,99 @@ int tty_set_attribs(int fd, int speed)
 
         return 0;
 }
+
+static int dev_try_open(const char *dev, int flags)
+{
+	int fd = open(dev, flags);
+
+	if (fd >= 0)
+		return fd;
+	return -errno;
+}
+
+#ifdef __linux__
+/* Wake up on any change of the directory holding the device, the device
+ * node might be created or get its permissions fixed by udev.
+ */
+static int dev_watch(const char *dev)
+{
+	char dir[PATH_MAX];
+	const char *slash = strrchr(dev, '/');
+	int fd;
+
+	if (!slash) {
+		strcpy(dir, ".");
+	} else if (slash == dev) {
+		strcpy(dir, "/");
+	} else {
+		if (slash - dev >= (int)sizeof(dir))
+			return -ENAMETOOLONG;
+		memcpy(dir, dev, slash - dev);
+		dir[slash - dev] = '\0';
+	}
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (inotify_add_watch(fd, dir, IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+#endif
+
+int dev_wait_open(const char *dev, int flags, int timeout_ms)
+{
+	uint32_t start = time_ms();
+	int backoff = DEV_POLL_MIN_MS;
+	int watch = -1;
+	int fd;
+
+#ifdef __linux__
+	/* Arm the watch before the first attempt so no event can be missed */
+	watch = dev_watch(dev);
+#endif
+
+	while ((fd = dev_try_open(dev, flags)) < 0) {
+		int elapsed = time_ms() - start;
+		int wait;
+
+		if ((timeout_ms >= 0 && elapsed >= timeout_ms) || fd == -EINTR)
+			break;
+
+#ifdef __linux__
+		if (watch >= 0) {
+			struct pollfd pfd = { .fd = watch, .events = POLLIN };
+			char ev[sizeof(struct inotify_event) + NAME_MAX + 1];
+
+			/* Any event triggers a new attempt. Keep a slow poll as
+			 * fallback for nodes that show up without events. */
+			wait = DEV_POLL_MAX_MS;
+			if (timeout_ms >= 0 && wait > timeout_ms - elapsed)
+				wait = timeout_ms - elapsed;
+			if (poll(&pfd, 1, wait) < 0 && errno == EINTR) {
+				fd = -EINTR;
+				break;
+			}
+			while (read(watch, ev, sizeof(ev)) > 0)
+				;
+			continue;
+		}
+#endif
+
+		wait = backoff;
+		if (timeout_ms >= 0 && wait > timeout_ms - elapsed)
+			wait = timeout_ms - elapsed;
+		if (usleep(wait * 1000) < 0 && errno == EINTR) {
+			fd = -EINTR;
+			break;
+		}
+		if (backoff < DEV_POLL_MAX_MS)
+			backoff *= 2;
+	}
+
+	if (watch >= 0)
+		close(watch);
+	return fd;
+}
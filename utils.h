@@ -20,10 +20,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef _UTILS_H
 #define _UTILS_H
 
-#define error(args...) fprintf(stderr, ##args)
-#define info(args...) fprintf(stderr, ##args)
-#define dbg(args...) fprintf(stderr, ##args)
+#include <stdint.h>
+#include "log.h"
+
+#define error(fmt, args...) log_msg(LOG_LVL_ERR, fmt, ##args)
+#define info(fmt, args...) log_msg(LOG_LVL_INFO, fmt, ##args)
+#define dbg(fmt, args...) log_msg(LOG_LVL_DBG, fmt, ##args)
 
 int tty_set_attribs(int fd, int speed);
 
+/* Open dev as soon as it can be opened, waiting at most timeout_ms for it
+ * to show up (forever if negative).
+ * Returns the file descriptor or -errno, -EINTR as soon as a signal
+ * interrupts the wait.
+ */
+int dev_wait_open(const char *dev, int flags, int timeout_ms);
+
+/* Monotonic time */
+uint32_t time_ms(void);
+uint64_t time_us(void);
+
 #endif /* _UTILS_H */
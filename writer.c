@@ -0,0 +1,365 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "circ_buf.h"
+#include "utils.h"
+#include "writer.h"
+
+/* Consecutive write batches handed to a single writev() */
+#define WRITER_IOV 8
+/* Failed attempts before a batch is given up */
+#define WRITER_MAX_RETRY 3
+
+#if (WRITER_QUEUE_LEN & (WRITER_QUEUE_LEN - 1))
+#  error "WRITER_QUEUE_LEN must be a power of 2"
+#endif
+
+struct writer_batch {
+	/* 0 for a write, the ioctl request otherwise */
+	int req;
+	uint16_t len;
+	uint8_t cls;
+	union {
+		uint8_t data[WRITER_BATCH_SIZE];
+		long align;
+	} u;
+};
+
+struct writer {
+	int fd;
+	pthread_t thread;
+	/* Protects everything below */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int run;
+	int failed;
+	/* The thread owns the batches from tail to head */
+	unsigned int head;
+	unsigned int tail;
+	int pending;
+	struct writer_stats st;
+	struct writer_batch q[WRITER_QUEUE_LEN];
+};
+
+static void writer_error(struct writer *w, int err)
+{
+	pthread_mutex_lock(&w->lock);
+	w->st.errors++;
+	w->st.last_error = err;
+	w->failed = 1;
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Return the bytes written, a negative errno if the device did not take
+ * them all. */
+static int writer_writev(struct writer *w, struct iovec *iov, int n)
+{
+	struct pollfd pfd = { .fd = w->fd, .events = POLLOUT };
+	int retries = 0, total = 0, err = 0;
+	ssize_t ret;
+	int i, lost;
+
+	while (n > 0) {
+		ret = writev(w->fd, iov, n);
+		if (ret > 0) {
+			total += ret;
+			while (n > 0 && ret >= iov->iov_len) {
+				ret -= iov->iov_len;
+				iov++;
+				n--;
+			}
+			if (n > 0) {
+				iov->iov_base = (uint8_t *)iov->iov_base + ret;
+				iov->iov_len -= ret;
+			}
+			/* The device is moving */
+			retries = 0;
+			continue;
+		}
+
+		err = ret < 0 ? -errno : -EAGAIN;
+		if (err == -EINTR)
+			continue;
+		if (err == -EAGAIN) {
+			ret = poll(&pfd, 1, WRITER_TIMEOUT_MS);
+			if (ret > 0)
+				continue;
+			err = ret < 0 ? -errno : -ETIMEDOUT;
+		} else {
+			usleep(WRITER_TIMEOUT_MS * 1000 / WRITER_MAX_RETRY);
+		}
+
+		pthread_mutex_lock(&w->lock);
+		w->st.retries++;
+		pthread_mutex_unlock(&w->lock);
+		if (++retries > WRITER_MAX_RETRY)
+			goto exit_err;
+	}
+	return total;
+
+exit_err:
+	for (i = 0, lost = 0; i < n; i++)
+		lost += iov[i].iov_len;
+	writer_error(w, err);
+	error("writer: write failed: %d, %d bytes lost\n", err, lost);
+	return err;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct writer *w = arg;
+	struct iovec iov[WRITER_IOV];
+	struct writer_batch *b;
+	unsigned int tail;
+	uint32_t start;
+	int n, bytes, len, cls;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (w->run && w->head == w->tail)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->head == w->tail)
+			break;
+
+		/* Batches are not touched by the submitter until tail moves */
+		tail = w->tail;
+		b = &w->q[tail];
+		cls = b->cls;
+		len = 0;
+		n = 0;
+		if (!b->req) {
+			/* Only one class per call, so that its time is known */
+			do {
+				iov[n].iov_base = b->u.data;
+				iov[n].iov_len = b->len;
+				len += b->len;
+				n++;
+				b = &w->q[(tail + n) & (WRITER_QUEUE_LEN - 1)];
+			} while (n < WRITER_IOV &&
+				 CIRC_CNT(w->head, tail, WRITER_QUEUE_LEN) > n &&
+				 !b->req && b->cls == cls);
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		start = time_us();
+		if (n) {
+			bytes = writer_writev(w, iov, n);
+		} else {
+			bytes = 0;
+			n = 1;
+			len = b->len;
+			if (ioctl(w->fd, b->req, (unsigned long)b->u.data) < 0) {
+				error("writer: ioctl 0x%x failed: %d\n", b->req, -errno);
+				writer_error(w, -errno);
+			}
+		}
+		start = time_us() - start;
+
+		pthread_mutex_lock(&w->lock);
+		if (bytes > 0) {
+			w->st.bytes += bytes;
+			w->st.batches += n;
+		} else if (!bytes) {
+			w->st.ioctls++;
+		}
+		w->st.cls[cls].count++;
+		w->st.cls[cls].bytes += len;
+		w->st.cls[cls].us += start;
+		w->pending -= len;
+		w->tail = (tail + n) & (WRITER_QUEUE_LEN - 1);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+struct writer *writer_init(int fd)
+{
+	struct writer *w;
+	int flags, ret;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->fd = fd;
+	w->run = 1;
+
+	/* Drivers without non blocking support just block the thread */
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		info("writer: blocking writes\n");
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	ret = pthread_create(&w->thread, NULL, writer_thread, w);
+	if (ret) {
+		error("writer: thread creation failed: %d\n", -ret);
+		goto exit_alloc;
+	}
+	return w;
+
+exit_alloc:
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+	return NULL;
+}
+
+void writer_deinit(struct writer *w)
+{
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->lock);
+	w->run = 0;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	info("writer: %u batches %u bytes %u ioctls, queue full %u times, "
+	     "max depth %u\n", w->st.batches, w->st.bytes, w->st.ioctls,
+	     w->st.full, w->st.max_depth);
+	if (w->st.errors)
+		error("writer: %u errors, %u retries, last %d\n", w->st.errors,
+		      w->st.retries, w->st.last_error);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+/* Called with the lock held, there must be room for one batch */
+static struct writer_batch *writer_push(struct writer *w)
+{
+	struct writer_batch *b = &w->q[w->head];
+
+	w->head = (w->head + 1) & (WRITER_QUEUE_LEN - 1);
+	return b;
+}
+
+static void writer_queued(struct writer *w)
+{
+	int depth = CIRC_CNT(w->head, w->tail, WRITER_QUEUE_LEN);
+
+	if (depth > w->st.max_depth)
+		w->st.max_depth = depth;
+	pthread_cond_signal(&w->cond);
+}
+
+int writer_submit(struct writer *w, const uint8_t *buf, int len, int cls)
+{
+	struct writer_batch *b;
+	int need = (len + WRITER_BATCH_SIZE - 1) / WRITER_BATCH_SIZE;
+
+	if (len <= 0)
+		return 0;
+
+	pthread_mutex_lock(&w->lock);
+	if (CIRC_SPACE(w->head, w->tail, WRITER_QUEUE_LEN) < need) {
+		w->st.full++;
+		pthread_mutex_unlock(&w->lock);
+		return -EAGAIN;
+	}
+	w->pending += len;
+	while (len > 0) {
+		b = writer_push(w);
+		b->req = 0;
+		b->cls = cls & (WRITER_NCLASS - 1);
+		b->len = len < WRITER_BATCH_SIZE ? len : WRITER_BATCH_SIZE;
+		memcpy(b->u.data, buf, b->len);
+		buf += b->len;
+		len -= b->len;
+	}
+	writer_queued(w);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+int writer_submit_ioctl(struct writer *w, int req, const void *arg, int len,
+			int cls)
+{
+	struct writer_batch *b;
+
+	if (!req || len > WRITER_BATCH_SIZE)
+		return -EINVAL;
+
+	pthread_mutex_lock(&w->lock);
+	if (!CIRC_SPACE(w->head, w->tail, WRITER_QUEUE_LEN)) {
+		w->st.full++;
+		pthread_mutex_unlock(&w->lock);
+		return -EAGAIN;
+	}
+	b = writer_push(w);
+	b->req = req;
+	b->cls = cls & (WRITER_NCLASS - 1);
+	b->len = len;
+	w->pending += len;
+	memcpy(b->u.data, arg, len);
+	writer_queued(w);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+int writer_space(struct writer *w)
+{
+	int space;
+
+	pthread_mutex_lock(&w->lock);
+	space = CIRC_SPACE(w->head, w->tail, WRITER_QUEUE_LEN);
+	pthread_mutex_unlock(&w->lock);
+	return space;
+}
+
+int writer_pending(struct writer *w)
+{
+	int pending;
+
+	pthread_mutex_lock(&w->lock);
+	pending = w->pending;
+	pthread_mutex_unlock(&w->lock);
+	return pending;
+}
+
+int writer_failed(struct writer *w)
+{
+	int failed;
+
+	pthread_mutex_lock(&w->lock);
+	failed = w->failed;
+	w->failed = 0;
+	pthread_mutex_unlock(&w->lock);
+	return failed;
+}
+
+void writer_stats(struct writer *w, struct writer_stats *st)
+{
+	pthread_mutex_lock(&w->lock);
+	*st = w->st;
+	pthread_mutex_unlock(&w->lock);
+}
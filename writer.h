@@ -0,0 +1,95 @@
+/*
+lcd_translator_apps
+
+Copyright (C) 2023 Federico Braghiroli
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+
+#ifdef CONFIG_LCD_TRANSLATOR_WRITER_QUEUE
+#  define WRITER_QUEUE_LEN CONFIG_LCD_TRANSLATOR_WRITER_QUEUE
+#else
+#  define WRITER_QUEUE_LEN 32 /* Must be power of 2 */
+#endif
+
+#ifdef CONFIG_LCD_TRANSLATOR_WRITER_TIMEOUT_MS
+#  define WRITER_TIMEOUT_MS CONFIG_LCD_TRANSLATOR_WRITER_TIMEOUT_MS
+#else
+#  define WRITER_TIMEOUT_MS 200
+#endif
+
+/* Bigger submissions take more than one slot of the queue */
+#define WRITER_BATCH_SIZE 64
+
+/* Submissions are tagged with a class chosen by the caller, the time the
+ * device takes is accounted per class. */
+#define WRITER_NCLASS 8
+
+struct writer_class {
+	/* write() / ioctl() calls, bytes and time spent in them */
+	uint32_t count;
+	uint32_t bytes;
+	uint32_t us;
+};
+
+struct writer_stats {
+	uint32_t batches;
+	uint32_t bytes;
+	uint32_t ioctls;
+	/* Submissions refused because the queue was full */
+	uint32_t full;
+	/* Write attempts that did not complete, and batches given up */
+	uint32_t retries;
+	uint32_t errors;
+	int last_error;
+	/* Highest number of queued batches */
+	uint16_t max_depth;
+	struct writer_class cls[WRITER_NCLASS];
+};
+
+struct writer;
+
+/* Output to fd is done by a dedicated thread, the caller never waits for
+ * the device. fd is switched to non blocking mode when possible.
+ */
+struct writer *writer_init(int fd);
+/* Wait for the queued batches to be written (at most WRITER_TIMEOUT_MS
+ * each) and stop the thread. fd is not closed. */
+void writer_deinit(struct writer *w);
+
+/* Queue bytes for the device, all or nothing.
+ * Return 0 or -EAGAIN when the queue is full: the caller decides what to
+ * drop, nothing is written out of order.
+ */
+int writer_submit(struct writer *w, const uint8_t *buf, int len, int cls);
+/* Queue an ioctl, executed in order with the writes. arg is copied. */
+int writer_submit_ioctl(struct writer *w, int req, const void *arg, int len,
+			int cls);
+
+/* Free batches in the queue */
+int writer_space(struct writer *w);
+/* Bytes not written yet, ioctls included */
+int writer_pending(struct writer *w);
+/* Return 1 once after something could not be written: what the device
+ * shows is no longer known. */
+int writer_failed(struct writer *w);
+
+void writer_stats(struct writer *w, struct writer_stats *st);
+
+#endif /* WRITER_H */